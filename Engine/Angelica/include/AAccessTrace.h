@@ -0,0 +1,51 @@
+#ifndef _AACCESSTRACE_H_
+#define _AACCESSTRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <unordered_set>
+
+// First access of one payload within a load phase
+struct AACCESSTRACE_RECORD
+{
+	std::uint64_t key;    // Payload the caller recorded
+	std::uint64_t micros; // Time since Start()
+	std::uint32_t phase;  // Index into GetPhases()
+};
+
+// Thread-safe recorder of which payloads are read in which load phase, in first-access order.
+// Only the first access per phase is kept, so repeated reads cost a set lookup and no memory.
+class AAccessTrace
+{
+public:
+	AAccessTrace() = default;
+
+	AAccessTrace(const AAccessTrace&) = delete;
+	AAccessTrace& operator=(const AAccessTrace&) = delete;
+
+	// Start() drops what was recorded before and begins in an unnamed phase
+	void Start();
+	void Stop() { m_recording.store(false, std::memory_order_relaxed); }
+	[[nodiscard]] bool IsRecording() const noexcept { return m_recording.load(std::memory_order_relaxed); }
+
+	// Later accesses belong to phase; a phase seen before is continued. Names must not contain
+	// tabs or line breaks, since traces are saved as text.
+	bool SetPhase(std::string_view phase);
+
+	void Record(std::uint64_t key);
+
+	[[nodiscard]] std::vector<AACCESSTRACE_RECORD> GetRecords() const;
+	[[nodiscard]] std::vector<std::string> GetPhases() const;
+
+private:
+	mutable std::mutex m_mutex;
+	std::atomic<bool> m_recording = false;
+	std::chrono::steady_clock::time_point m_start;
+	std::vector<std::string> m_phases;
+	std::uint32_t m_phase = 0;
+	std::unordered_set<std::uint64_t> m_seen; // Keys recorded in the current phase
+	std::vector<AACCESSTRACE_RECORD> m_records;
+};
+
+#endif
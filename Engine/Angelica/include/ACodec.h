@@ -0,0 +1,41 @@
+#ifndef _ACODEC_H_
+#define _ACODEC_H_
+
+#include <span>
+
+// Codec ids as stored in package entries (8 bits)
+constexpr std::uint32_t ACODEC_ZLIB = 0; // zlib stream, the only codec before package version 0x00010005
+constexpr std::uint32_t ACODEC_LZ = 1;   // In-tree byte-oriented LZ77, built for decode speed
+constexpr std::uint32_t ACODEC_MAXID = 0xFF;
+
+// Block compressor interface. Implementations must be stateless so one instance can be
+// used from several threads at once.
+class ACodec
+{
+public:
+	virtual ~ACodec() = default;
+
+	[[nodiscard]] virtual std::uint32_t GetId() const noexcept = 0;
+	[[nodiscard]] virtual const wchar_t* GetName() const noexcept = 0;
+
+	// Worst-case compressed size for sourceSize input bytes
+	[[nodiscard]] virtual std::size_t GetCompressBound(std::size_t sourceSize) const noexcept = 0;
+
+	// Returns the compressed size, or 0 if dest is too small or compression failed
+	virtual std::size_t Compress(std::span<const std::byte> source, std::span<std::byte> dest, int level) const = 0;
+
+	// Fills exactly dest.size() bytes; returns false on corrupt or truncated input
+	virtual bool Decompress(std::span<const std::byte> source, std::span<std::byte> dest) const = 0;
+};
+
+// Codec registry. The built-in zlib and LZ codecs are always present; custom codecs must
+// outlive every package that uses them and should be registered before packages are opened.
+const ACodec* ACodec_Find(std::uint32_t codecId);
+bool ACodec_Register(const ACodec* codec);
+
+// zlib streams primed with a preset dictionary (deflateSetDictionary()/inflateSetDictionary()).
+// The stream header carries the dictionary's Adler-32, so decoding with another dictionary fails.
+std::size_t ACodec_ZlibCompress(std::span<const std::byte> source, std::span<std::byte> dest, int level, std::span<const std::byte> dictionary);
+bool ACodec_ZlibDecompress(std::span<const std::byte> source, std::span<std::byte> dest, std::span<const std::byte> dictionary);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef _ACOMPRESSIONPOLICY_H_
+#define _ACOMPRESSIONPOLICY_H_
+
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ACodec.h"
+
+// What to do with one file before it is encoded
+struct ACOMPRESSIONDECISION
+{
+	bool compress; // false stores the file without a compression attempt
+	int level;     // Compression level when compressing
+};
+
+// Decides per file whether and how hard a package compresses it. Decide() runs on the
+// AppendFiles() workers too, so implementations must be thread-safe.
+class ACompressionPolicy
+{
+public:
+	virtual ~ACompressionPolicy() = default;
+
+	// normalizedName is the entry name; baseLevel is the level the caller asked for
+	virtual ACOMPRESSIONDECISION Decide(std::string_view normalizedName, std::span<const std::byte> fileData, const ACodec& codec, int baseLevel) const = 0;
+};
+
+// Rule modes of AAdaptiveCompressionPolicy
+constexpr int ACOMPRESSION_AUTO = 0;   // Sample the data and trial-compress a prefix when in doubt
+constexpr int ACOMPRESSION_STORE = 1;  // Never compress
+constexpr int ACOMPRESSION_ALWAYS = 2; // Always compress, without sampling
+
+// Level that leaves the choice to the size levels or the caller
+constexpr int ACOMPRESSION_LEVEL_AUTO = -1;
+
+struct ACOMPRESSIONRULE
+{
+	int mode = ACOMPRESSION_AUTO;
+	int level = ACOMPRESSION_LEVEL_AUTO;
+};
+
+// Default policy. Extension rules come first; already-compressed media (ogg, mp3, jpg, png, zip
+// and similar) are stored by default. Other files larger than the trial size are sampled: nearly
+// random data is stored at once, and data that may or may not shrink is decided by compressing
+// a prefix. Files that are compressed get the level of their extension rule, else of the largest
+// size level they reach, else the caller's.
+class AAdaptiveCompressionPolicy : public ACompressionPolicy
+{
+public:
+	AAdaptiveCompressionPolicy();
+
+	// extension without or with the leading dot, any case
+	void SetExtensionRule(std::string_view extension, ACOMPRESSIONRULE rule);
+	void RemoveExtensionRule(std::string_view extension);
+
+	// Files of at least minSize bytes use level unless their extension rule names one
+	void SetSizeLevel(std::size_t minSize, int level);
+
+	// Order-0 entropy in bits per byte above which data is stored without a trial, and above which
+	// a prefix of trialBytes is trial-compressed; the trial must save minTrialSavings (0-1) of it.
+	void SetThresholds(double storeEntropy, double trialEntropy, std::size_t trialBytes, double minTrialSavings);
+
+	ACOMPRESSIONDECISION Decide(std::string_view normalizedName, std::span<const std::byte> fileData, const ACodec& codec, int baseLevel) const override;
+
+private:
+	int SelectLevel(const ACOMPRESSIONRULE* rule, std::size_t fileSize, int baseLevel) const;
+
+	std::unordered_map<std::string, ACOMPRESSIONRULE> m_rules;
+	std::vector<std::pair<std::size_t, int>> m_sizeLevels; // Sorted by size
+	double m_storeEntropy = 7.9;
+	double m_trialEntropy = 6.5;
+	std::size_t m_trialBytes = 0x4000;
+	double m_minTrialSavings = 0.05;
+};
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef _ADICTIONARYTRAINER_H_
+#define _ADICTIONARYTRAINER_H_
+
+#include <span>
+#include <vector>
+
+// Largest useful zlib preset dictionary: deflate only looks back one 32 KB window
+constexpr std::size_t ADICTIONARY_MAXSIZE = 0x8000;
+
+// Builds a zlib preset dictionary of at most maxBytes from sample files of one kind. Segments
+// are picked greedily by how many of their 8-byte substrings recur across different samples, and
+// the most valuable segments are placed last, where deflate reaches them with the shortest distances.
+// Returns an empty dictionary if the samples share nothing.
+std::vector<std::byte> ADictionary_Train(std::span<const std::span<const std::byte>> samples, std::size_t maxBytes = 0x4000);
+
+#endif
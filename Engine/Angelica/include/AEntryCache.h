@@ -0,0 +1,65 @@
+#ifndef _AENTRYCACHE_H_
+#define _AENTRYCACHE_H_
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+using AEntryBuffer = std::shared_ptr<const std::vector<std::byte>>;
+
+struct AENTRYCACHE_STATS
+{
+	std::uint64_t hits;       // Lookups served from the cache
+	std::uint64_t misses;     // Lookups that had to decode the entry
+	std::uint64_t evictions;  // Buffers dropped to stay inside the budget
+	std::size_t bytesUsed;    // Decoded bytes currently held
+	std::size_t entryCount;   // Buffers currently held
+	std::size_t byteBudget;   // Configured limit, 0 if disabled
+};
+
+// Thread-safe LRU cache of decoded package entries bounded by a byte budget.
+// Buffers are shared and immutable, so a hit hands out a reference instead of a copy;
+// an evicted buffer stays alive for as long as a caller still holds it.
+class AEntryCache
+{
+public:
+	AEntryCache() = default;
+
+	AEntryCache(const AEntryCache&) = delete;
+	AEntryCache& operator=(const AEntryCache&) = delete;
+
+	// A budget of 0 disables the cache and releases everything it holds
+	void SetBudget(std::size_t byteBudget);
+	[[nodiscard]] std::size_t GetBudget() const;
+	[[nodiscard]] bool IsEnabled() const;
+
+	// Returns nullptr on a miss
+	AEntryBuffer Find(std::uint64_t key);
+	// Buffers larger than the whole budget are not kept
+	void Insert(std::uint64_t key, AEntryBuffer buffer);
+	void Erase(std::uint64_t key);
+	void Clear();
+
+	[[nodiscard]] AENTRYCACHE_STATS GetStats() const;
+	void ResetStats();
+
+private:
+	struct NODE
+	{
+		std::uint64_t key;
+		AEntryBuffer buffer;
+	};
+
+	void EvictTo(std::size_t byteLimit);
+
+	mutable std::mutex m_mutex;
+	std::list<NODE> m_lru; // Most recently used first
+	std::unordered_map<std::uint64_t, std::list<NODE>::iterator> m_nodes;
+	std::size_t m_byteBudget = 0;
+	std::size_t m_bytesUsed = 0;
+	std::uint64_t m_hits = 0;
+	std::uint64_t m_misses = 0;
+	std::uint64_t m_evictions = 0;
+};
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef _AFILEIMAGE_H_
 #define _AFILEIMAGE_H_
 
+#include <span>
 #include "AFile.h"
+#include "AEntryCache.h"
 
 class AFileImage : public AFile
 {
@@ -25,7 +27,8 @@ public:
     bool Seek(size_t offset, std::ios::seekdir origin) override;
 
     // Accessors (modernized)
-    [[nodiscard]] const std::vector<std::byte>& GetFileBuffer() const noexcept { return m_fileImage; }
+    [[nodiscard]] const std::vector<std::byte>& GetFileBuffer() const noexcept;
+    [[nodiscard]] std::span<const std::byte> GetFileView() const noexcept { return m_fileImage; }
     [[nodiscard]] size_t GetFileLength() const noexcept { return m_fileImage.size(); }
 
 protected:
@@ -37,7 +40,8 @@ private:
     bool FImgReadLine(std::string& line, size_t maxLineLength);
     bool FImgSeek(size_t offset, std::ios::seekdir origin);
 
-    std::vector<std::byte> m_fileImage;
+    AEntryBuffer m_imageBuffer;                // Shared with the package entry cache when loaded from a package
+    std::span<const std::byte> m_fileImage;    // View of m_imageBuffer
     size_t m_currentPos = 0;
 };
 
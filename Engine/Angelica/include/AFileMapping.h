@@ -0,0 +1,38 @@
+#ifndef _AFILEMAPPING_H_
+#define _AFILEMAPPING_H_
+
+#include <span>
+
+// Read-only memory mapping of a whole file.
+// Uses CreateFileMapping/MapViewOfFile on Windows and mmap elsewhere.
+class AFileMapping
+{
+public:
+	AFileMapping() = default;
+	~AFileMapping();
+
+	AFileMapping(const AFileMapping&) = delete;
+	AFileMapping& operator=(const AFileMapping&) = delete;
+
+	bool Open(std::wstring_view filePath);
+	void Close();
+
+	[[nodiscard]] bool IsOpen() const noexcept { return m_data != nullptr; }
+	[[nodiscard]] std::size_t GetSize() const noexcept { return m_size; }
+	[[nodiscard]] std::span<const std::byte> GetData() const noexcept { return { m_data, m_size }; }
+
+	// Returns an empty span if [offset, offset + length) is not inside the mapping
+	[[nodiscard]] std::span<const std::byte> GetRange(std::uint64_t offset, std::uint64_t length) const noexcept;
+
+private:
+#ifdef _WIN32
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = nullptr;
+#else
+	int m_fd = -1;
+#endif
+	const std::byte* m_data = nullptr;
+	std::size_t m_size = 0;
+};
+
+#endif
@@ -1,19 +1,68 @@
 #ifndef _AFILEPACKAGE_H_
 #define _AFILEPACKAGE_H_
 
+#include <array>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
 #include <span>
+#include <unordered_map>
+#include <unordered_set>
+#include "AAccessTrace.h"
+#include "ACodec.h"
+#include "ACompressionPolicy.h"
+#include "AEntryCache.h"
+#include "AFileMapping.h"
+#include "AHash128.h"
+#include "APositionalFile.h"
+#include "AThreadPool.h"
 
 //#define AFPCK_VERSION  0x00010001
 //#define AFPCK_VERSION  0x00010002 // Add compression
 //#define AFPCK_VERSION  0x00010003 // The final release version on June 2002
+//#define AFPCK_VERSION  0x00010004 // Per-entry flags, seekable block-compressed entries
+//#define AFPCK_VERSION  0x00010005 // Per-entry codec id
+//#define AFPCK_VERSION  0x00010006 // Append-only directory journal, checksummed footer
+//#define AFPCK_VERSION  0x00010007 // Small entries packed into shared solid blocks
+//#define AFPCK_VERSION  0x00010008 // Preset dictionaries for zlib entries
+//#define AFPCK_VERSION  0x00020000 // 64-bit offsets and lengths for packages past 4 GB; only with AFPCK_CREATE_LARGE
+
+// Entry flags
+constexpr std::uint32_t AFPCK_ENTRY_BLOCKED = 0x00000001u;    // Data is compressed as independent blocks with a block table
+constexpr std::uint32_t AFPCK_ENTRY_SOLID = 0x00000002u;      // Data is a slice of a solid block shared with other small entries
+constexpr std::uint32_t AFPCK_ENTRY_DICT_MASK = 0x000000FCu;  // Preset dictionary id of a zlib entry, 0 for none
+constexpr std::uint32_t AFPCK_ENTRY_DICT_SHIFT = 2;
+constexpr std::uint32_t AFPCK_ENTRY_CODEC_MASK = 0x0000FF00u; // ACODEC_XXX id of compressed data; zlib (0) before version 0x00010005
+constexpr std::uint32_t AFPCK_ENTRY_CODEC_SHIFT = 8;
+constexpr std::uint32_t AFPCK_ENTRY_SOLID_OFFSET_MASK = 0xFFFF0000u; // Offset of a solid entry in its decoded block
+constexpr std::uint32_t AFPCK_ENTRY_SOLID_OFFSET_SHIFT = 16;
+
+// Codec selection for AppendFile(): use the extension rule or the package default
+constexpr std::uint32_t AFPCK_CODEC_AUTO = 0xFFFFFFFFu;
+
+// Preset dictionary <id> is stored as the entry AFPCK_DICTIONARY_FOLDER<id>, with ids from 1 to AFPCK_MAX_DICTIONARY
+constexpr std::string_view AFPCK_DICTIONARY_FOLDER = ".dictionaries\\";
+constexpr std::uint32_t AFPCK_MAX_DICTIONARY = AFPCK_ENTRY_DICT_MASK >> AFPCK_ENTRY_DICT_SHIFT;
 
 struct AFPCK_FILEENTRY
 {
 	char szFileName[260];             // The file name of this entry; this may contain a path
-	std::uint32_t dwOffset;           // The offset from the beginning of the package file
+	std::uint64_t dwOffset;           // The offset from the beginning of the package file
 	std::uint32_t dwLength;           // The length of this file
 	std::uint32_t dwCompressedLength; // The compressed data length
+	std::uint32_t dwFlags;            // AFPCK_ENTRY_XXX flags
+};
 
+// Compact in-memory directory record; the name lives in the package's name pool
+struct AFPCK_ENTRYINFO
+{
+	std::uint64_t dwOffset;           // The offset from the beginning of the package file
+	std::uint32_t dwLength;           // The length of this file
+	std::uint32_t dwCompressedLength; // The compressed data length
+	std::uint32_t dwFlags;            // AFPCK_ENTRY_XXX flags
+	std::uint32_t dwNameOffset;       // Offset of the null-terminated name in the name pool
+	std::uint32_t dwNameLength;       // Name length in bytes, without the terminator
 };
 
 struct AFPCK_FILEHEADER
@@ -23,62 +72,500 @@ struct AFPCK_FILEHEADER
 	char szDescription[256];     // size of array must be 256 bytes
 };
 
+// Header of version 0x00020000 packages; packages of the other versions are reported in it too
+struct AFPCK_FILEHEADER64
+{
+	std::uint32_t dwVersion;
+	std::uint32_t dwReserved;
+	std::uint64_t dwEntryOffset; // The entry list offset from the beginning
+	char szDescription[256];
+};
+
+// One file for AFilePackage::AppendFiles(); the data must stay alive until the call returns
+struct AFPCK_APPENDITEM
+{
+	std::wstring_view fileName;
+	std::span<const std::byte> fileData;
+	std::uint32_t codecId = AFPCK_CODEC_AUTO;
+};
+
+// Throughput report of AFilePackage::AppendFiles()
+struct AFPCK_BATCHSTATS
+{
+	std::size_t fileCount;      // Files appended
+	std::uint64_t rawBytes;     // Uncompressed input bytes
+	std::uint64_t storedBytes;  // Bytes written to the package
+	double seconds;             // Wall-clock time of the whole batch
+	double compressSeconds;     // Compression time summed over all workers
+	double rawMBPerSecond;      // Input throughput against wall-clock time
+	unsigned int workerCount;   // Compression threads used
+	std::size_t dedupedFiles;   // Files that share an existing payload instead of writing one
+	std::size_t solidFiles;     // Files packed into solid blocks, see AFilePackage::SetSolidBlocks()
+	std::size_t solidBlocks;    // Solid blocks written
+};
+
+// One entry of AFilePackage::ReadFiles()
+struct AFPCK_READREQUEST
+{
+	const AFPCK_ENTRYINFO* entry;
+	std::span<std::byte> buffer; // Receives the whole entry; must hold at least dwLength bytes
+	std::size_t bytesRead;       // Set by ReadFiles()
+	bool succeeded;              // Set by ReadFiles()
+};
+
+// Result of AFilePackage::Compact()
+struct AFPCK_COMPACTSTATS
+{
+	std::uint64_t oldSize;        // Package file size before compaction
+	std::uint64_t newSize;        // Package file size after compaction
+	std::uint64_t reclaimedBytes; // Dead bytes dropped
+	std::size_t entryCount;       // Live entries kept
+};
+
+// Savings of AFilePackage::SetDedup() since the package was opened
+struct AFPCK_DEDUPSTATS
+{
+	std::size_t dedupedFiles;   // Appended or replaced files that share an existing payload
+	std::uint64_t savedBytes;   // Stored bytes those files did not write
+	std::size_t hashCollisions; // Candidates with an equal hash but different content
+};
+
+// Ingestion report of one file category (lower-case extension) in AFilePackage::GetCategoryStats().
+// storedBytes / rawBytes is the category's compression ratio.
+struct AFPCK_CATEGORYSTATS
+{
+	std::size_t fileCount;
+	std::size_t skippedFiles;   // Stored without a compression attempt, as the compression policy decided
+	std::uint64_t rawBytes;
+	std::uint64_t storedBytes;  // Payload bytes written, solid blocks shared out by raw size
+	std::uint64_t skippedBytes; // Raw bytes of the skipped files
+	double policySeconds;       // Spent in the policy: sampling and trial compressions
+	double compressSeconds;     // Spent compressing
+	double savedSeconds;        // Compression time the skipped files would have cost at the package's average
+	                            // rate, less policySeconds; negative when deciding cost more than it saved
+};
+
+// Receives the consecutive chunks of AFilePackage::StreamFile(); returning false stops the read
+using AFPCK_STREAMSINK = std::function<bool(std::span<const std::byte> chunk)>;
+
 enum AFPCK_OPENMODE
 {
 	AFPCK_OPENEXIST = 0,
 	AFPCK_CREATENEW = 1
 };
 
+struct AAssetId;
+
+// Open flags
+constexpr std::uint32_t AFPCK_OPEN_MAPPED = 0x00000001u;     // Open an existing package read-only and memory-map it
+constexpr std::uint32_t AFPCK_OPEN_CONCURRENT = 0x00000002u; // Open an existing package read-only for positional reads from many threads
+constexpr std::uint32_t AFPCK_CREATE_LARGE = 0x00000004u;    // Create the package in the 64-bit format; it can grow past 4 GB but older readers can not open it
+
 class AFilePackage
 {
 public:
-	AFilePackage() = default;
+	AFilePackage();
 	~AFilePackage();
 
-	bool Open(std::wstring_view pckPath, AFPCK_OPENMODE mode);
+	bool Open(std::wstring_view pckPath, AFPCK_OPENMODE mode, std::uint32_t flags = 0);
 	bool Close();
 
-	bool AppendFile(std::wstring_view fileName, std::span<const std::byte> fileData);
+	// codecId is an ACODEC_XXX id, or AFPCK_CODEC_AUTO to use SetExtensionCodec()/SetDefaultCodec().
+	// Fails if the name exists already, use ReplaceFile() for that, or if it is longer than 259 bytes
+	// as normalized UTF-8.
+	bool AppendFile(std::wstring_view fileName, std::span<const std::byte> fileData, std::uint32_t codecId = AFPCK_CODEC_AUTO);
 	bool RemoveFile(std::wstring_view fileName);
 
+	// Compresses the items on a worker pool and appends them in input order, so the package
+	// layout does not depend on thread timing. compressionLevel is the zlib level (1-9);
+	// workerCount == 0 uses one worker per hardware core. Fails without writing anything if a name
+	// exists already, repeats within the batch or is too long for AppendFile().
+	bool AppendFiles(std::span<const AFPCK_APPENDITEM> items, int compressionLevel = 1, unsigned int workerCount = 0, AFPCK_BATCHSTATS* outStats = nullptr);
+
+	// Makes all changes so far durable without closing. Only the entries changed since the last
+	// commit are appended as a journal record; the journal is folded into a full directory once it
+	// grows past half the base directory. Close() commits as well.
+	bool Commit();
+
+	// Rewrites the package without the space abandoned by RemoveFile() and ReplaceFile().
+	// Payloads are copied as stored, without recompression, through a bounded buffer into a
+	// temporary file that replaces the package when complete. entryOrder lists entry indices
+	// to place first; the rest follow in their current order. Needs a writable AFPCK_OPENEXIST package.
+	bool Compact(AFPCK_COMPACTSTATS* outStats = nullptr, std::span<const std::uint32_t> entryOrder = {});
+
+	// Access tracing for Repack(). While a trace runs, every entry read from any thread records the
+	// first access of its payload in the current load phase. Save the trace before Close().
+	void StartAccessTrace() { m_accessTrace.Start(); }
+	bool SetAccessTracePhase(std::string_view phase) { return m_accessTrace.SetPhase(phase); }
+	void StopAccessTrace() { m_accessTrace.Stop(); }
+	// UTF-8 text, one "phase<TAB>microseconds<TAB>entry name" line per first access
+	bool SaveAccessTrace(std::wstring_view tracePath) const;
+
+	// Compact() with the payloads laid out in the order the traces first read them: phases in the
+	// order they first appear, entries within a phase in first-access order, untraced entries last.
+	// Traces of several sessions are merged in the order given; unknown names are skipped.
+	bool Repack(std::span<const std::wstring_view> tracePaths, AFPCK_COMPACTSTATS* outStats = nullptr);
+
+	// Commits, sorts the entries and writes the directory, name pool and hash index to the
+	// sidecar file <package>.idx. Open() takes them from there without parsing as long as the
+	// package is unchanged since; any later commit or rewrite makes Open() fall back to parsing.
+	bool SaveIndex();
+
+	// Dedup mode for AppendFile(), AppendFiles() and ReplaceFile(): a file whose content equals a
+	// payload written while the mode was on shares that payload instead of storing a copy. Matches
+	// are found by a 128-bit hash of the decoded data and verified byte for byte. Shared payloads
+	// are freed only when the last entry referencing them is removed or replaced.
+	void SetDedup(bool enable) { m_dedup = enable; }
+	[[nodiscard]] AFPCK_DEDUPSTATS GetDedupStats() const noexcept { return m_dedupStats; }
+
+	// Solid mode for AppendFiles(): files of at most maxFileLength bytes that use the default codec
+	// are packed in input order into shared blocks of up to 64 KB, compressed as one stream. Reading
+	// neighbouring small files then decodes their block once, see SetBlockCacheBudget(). AppendFile()
+	// and ReplaceFile() keep storing files on their own. 0 (the default) disables the mode.
+	bool SetSolidBlocks(std::size_t maxFileLength);
+
+	// Codec used for new data when AppendFile() gets AFPCK_CODEC_AUTO. Extension rules take
+	// precedence over the default; extension is given without or with the leading dot.
+	bool SetDefaultCodec(std::uint32_t codecId);
+	bool SetExtensionCodec(std::wstring_view extension, std::uint32_t codecId);
+
+	// Policy asked before AppendFile(), AppendFiles() and ReplaceFile() compress a file, which may
+	// store it without trying or pick its level; see AAdaptiveCompressionPolicy. nullptr (the default)
+	// compresses every file at the caller's level. The policy must outlive its use by the package.
+	void SetCompressionPolicy(const ACompressionPolicy* policy) { m_compressionPolicy = policy; }
+	// Per-category report of the files compressed or stored since the package was opened; files
+	// without an extension are under "". Files that share a dedup payload are not included.
+	[[nodiscard]] std::map<std::string, AFPCK_CATEGORYSTATS> GetCategoryStats() const;
+
+	// Preset dictionaries for zlib entries compressed as one stream, i.e. below 256 KB, so small files
+	// do not start from an empty window. New files whose extension has a dictionary rule are compressed
+	// with it. Dictionaries are stored uncompressed in the package and can not be removed or replaced;
+	// the rules are not, so after reopening SetExtensionDictionary() applies an existing id again.
+	// TrainDictionary() builds one from sample files with ADictionary_Train(), adds it and sets the rule.
+	// Both return the dictionary id, or 0 on failure.
+	std::uint32_t TrainDictionary(std::wstring_view extension, std::span<const std::span<const std::byte>> samples, std::size_t maxBytes = 0x4000);
+	std::uint32_t AddDictionary(std::span<const std::byte> dictionary);
+	bool SetExtensionDictionary(std::wstring_view extension, std::uint32_t dictionaryId); // 0 drops the rule
+
 #ifdef ReplaceFile
 #pragma push_macro("ReplaceFile")
 #undef ReplaceFile
-	bool ReplaceFile(std::wstring_view fileName, std::span<const std::byte> fileData);
+	bool ReplaceFile(std::wstring_view fileName, std::span<const std::byte> fileData, std::uint32_t codecId = AFPCK_CODEC_AUTO);
 #pragma pop_macro("ReplaceFile")
 #endif
 
+	// ReadFile may be called from several threads at once when the package was opened
+	// with AFPCK_OPEN_MAPPED or AFPCK_OPEN_CONCURRENT.
+	// Uncompressed, block-compressed and solid entries can be read partially at any offset; at most
+	// buffer.size() bytes are returned. Whole-stream compressed entries need offset 0 and a full-size buffer.
 	bool ReadFile(std::wstring_view fileName, std::span<std::byte> buffer, std::size_t offset, std::size_t& bytesRead);
 	bool ReadFile(const AFPCK_FILEENTRY& entry, std::span<std::byte> buffer, std::size_t offset, std::size_t& bytesRead);
+	bool ReadFile(const AFPCK_ENTRYINFO& entry, std::span<std::byte> buffer, std::size_t offset, std::size_t& bytesRead);
+
+	// Delivers the whole decoded entry to sink in order, in chunks of at most chunkSize bytes
+	// (rounded to whole blocks), with scratch memory bounded by about twice the chunk size.
+	// Returns false if the entry can not be read or the sink stopped the read.
+	bool StreamFile(std::wstring_view fileName, const AFPCK_STREAMSINK& sink, std::size_t chunkSize = 0x40000);
+	bool StreamFile(const AFPCK_ENTRYINFO& entry, const AFPCK_STREAMSINK& sink, std::size_t chunkSize = 0x40000);
+
+	// Reads many whole entries in package order. Entries within maxGap bytes of each other are
+	// fetched with one sequential read and then scattered into the callers' buffers. Returns
+	// false if any request failed; see AFPCK_READREQUEST::succeeded.
+	bool ReadFiles(std::span<AFPCK_READREQUEST> requests, std::size_t maxGap = 0x10000);
+
+	// Whole decoded entry as a shared immutable buffer, nullptr on failure. Goes through the
+	// entry cache when SetCacheBudget() enabled it, so repeated loads decode and copy nothing.
+	AEntryBuffer ReadFileShared(const AFPCK_ENTRYINFO& entry);
+
+	// Decoded-entry cache used by ReadFileShared(); a budget of 0 (the default) disables it
+	void SetCacheBudget(std::size_t byteBudget) { m_entryCache.SetBudget(byteBudget); }
+	void ClearCache() { m_entryCache.Clear(); }
+	[[nodiscard]] AENTRYCACHE_STATS GetCacheStats() const { return m_entryCache.GetStats(); }
+
+	// Decoded solid blocks shared by all reads of their entries; enabled with 4 MB by default
+	void SetBlockCacheBudget(std::size_t byteBudget) { m_blockCache.SetBudget(byteBudget); }
+	[[nodiscard]] AENTRYCACHE_STATS GetBlockCacheStats() const { return m_blockCache.GetStats(); }
+
+	// Background reads on the package's async pool; they need a package opened with AFPCK_OPEN_MAPPED
+	// or AFPCK_OPEN_CONCURRENT. A cancelled or failed read yields nullptr; the callback runs on a
+	// pool thread. Close() cancels whatever is still queued.
+	std::future<AEntryBuffer> ReadAsync(const AFPCK_ENTRYINFO& entry, ACancelToken cancel = {});
+	bool ReadAsync(const AFPCK_ENTRYINFO& entry, std::function<void(AEntryBuffer)> onComplete, ACancelToken cancel = {});
+
+	// Decodes the named entries into the entry cache in the background so later loads hit it.
+	// Returns the number of entries queued; unknown names are skipped.
+	std::size_t Prefetch(std::span<const std::wstring_view> fileNames, ACancelToken cancel = {});
 
+	// Threads of the async pool, applied when the pool is first used; 0 uses one per hardware core
+	void SetAsyncWorkerCount(unsigned int workerCount) { m_asyncWorkerCount = workerCount; }
+
+	// Zero-copy view of an uncompressed entry; only available when the package is mapped
+	bool GetFileView(const AFPCK_FILEENTRY& entry, std::span<const std::byte>& outView) const;
+	bool GetFileView(const AFPCK_ENTRYINFO& entry, std::span<const std::byte>& outView) const;
+
+	// Handle lookups. The returned pointers stay valid until the directory is modified.
+	[[nodiscard]] const AFPCK_ENTRYINFO* FindFile(std::wstring_view fileName) const;
+	// UTF-8 names match as if normalized: either separator, any case, leading .\ and spaces ignored.
+	// These and the wide lookups above do not allocate unless the name is longer than NAME_BUFFER_SIZE.
+	[[nodiscard]] const AFPCK_ENTRYINFO* FindFile(std::string_view utf8Name) const;
+	// nameHash is HashFileName() of the normalized name; nullptr if another entry shares the hash
+	[[nodiscard]] const AFPCK_ENTRYINFO* FindFileByHash(std::uint64_t nameHash) const;
+	[[nodiscard]] const AFPCK_ENTRYINFO* FindFile(AAssetId id) const;
+	[[nodiscard]] const AFPCK_ENTRYINFO* GetEntryByIndex(std::size_t index) const noexcept;
+	[[nodiscard]] std::string_view GetEntryName(const AFPCK_ENTRYINFO& entry) const noexcept;
+
+	// Copying lookups, kept for callers that need the full legacy entry
 	bool GetFileEntry(std::wstring_view fileName, AFPCK_FILEENTRY& outEntry, int* outIndex = nullptr) const;
+	bool GetFileEntry(std::string_view utf8Name, AFPCK_FILEENTRY& outEntry, int* outIndex = nullptr) const;
+	bool GetFileEntry(AAssetId id, AFPCK_FILEENTRY& outEntry, int* outIndex = nullptr) const;
 	bool GetFileEntryByIndex(int index, AFPCK_FILEENTRY& outEntry) const;
 
+	// Entry name as stored in the directory (UTF-8, backslash separators, no leading dot folder),
+	// and the case-folded hash the lookup index uses for it
+	static std::string NormalizeFileName(std::wstring_view fileName);
+	// 64-bit FNV-1a over the bytes with ASCII case and '/' folded, so it does not depend on the
+	// platform or locale; it is what the index and the persisted .idx sidecar store.
+	static constexpr std::uint64_t HashFileName(std::string_view normalizedName) noexcept { return HashName(normalizedName); }
+
+	// Non-allocating pieces of NormalizeFileName(). TrimFileName() drops the leading .\ and the
+	// spaces but leaves separators as they are; FileNamesEqual() compares trimmed names the way the
+	// index does. EncodeFileName() does both for a wide name into buffer, false if it does not fit.
+	static constexpr std::size_t NAME_BUFFER_SIZE = 1024;
+	static constexpr std::string_view TrimFileName(std::string_view utf8Name) noexcept { return TrimName(utf8Name); }
+	static bool FileNamesEqual(std::string_view a, std::string_view b) noexcept;
+	static bool EncodeFileName(std::wstring_view fileName, std::span<char> buffer, std::string_view& outName) noexcept;
+
+	// Sorts entries by name; lookups go through the hash index and do not depend on it
 	bool ResortEntries();
 
 	[[nodiscard]] size_t GetFileNumber() const noexcept { return m_fileEntries.size(); }
-	[[nodiscard]] const AFPCK_FILEHEADER& GetFileHeader() const noexcept { return m_header; }
+	[[nodiscard]] const AFPCK_FILEHEADER64& GetFileHeader() const noexcept { return m_header; }
+	[[nodiscard]] bool IsLarge() const noexcept { return m_header.dwVersion == LARGE_VERSION; } // 64-bit format
+	[[nodiscard]] std::uint64_t GetFreeSpace() const noexcept { return m_freeBytes; } // Reusable hole bytes
+	[[nodiscard]] bool IsMapped() const noexcept { return m_mapping.IsOpen(); }
+	[[nodiscard]] bool IsConcurrent() const noexcept { return m_mapping.IsOpen() || m_positionalFile.IsOpen(); }
 
 private:
+	friend struct AAssetId;
+
+	// Shared by the char and char8_t (AAssetId) paths; a cast between the two is not a constant expression
+	template <typename CharT>
+	static constexpr std::uint64_t HashName(std::basic_string_view<CharT> name) noexcept
+	{
+		std::uint64_t hash = 0xcbf29ce484222325ull;
+		for (CharT ch : name)
+		{
+			unsigned char c = static_cast<unsigned char>(ch);
+			if (c == '/')
+				c = '\\';
+			else if (c >= 'A' && c <= 'Z')
+				c = static_cast<unsigned char>(c - 'A' + 'a');
+
+			hash ^= c;
+			hash *= 0x100000001b3ull;
+		}
+
+		return hash;
+	}
+
+	// Same steps and order as NormalizeFileName()
+	template <typename CharT>
+	static constexpr std::basic_string_view<CharT> TrimName(std::basic_string_view<CharT> name) noexcept
+	{
+		if (name.size() >= 2 && name[0] == CharT('.') && (name[1] == CharT('\\') || name[1] == CharT('/')))
+			name.remove_prefix(2);
+
+		const std::size_t last = name.find_last_not_of(CharT(' '));
+		if (last == std::basic_string_view<CharT>::npos)
+			return {};
+
+		name = name.substr(0, last + 1);
+		name.remove_prefix(name.find_first_not_of(CharT(' ')));
+
+		return name;
+	}
+
 	bool LoadEntries();
 	bool SaveEntries();
-	std::string NormalizeFileName(std::wstring_view fileName) const;
+	static std::size_t GetFooterSize(std::uint32_t version) noexcept;
+	bool ReadFooter(std::uint64_t footerEnd, std::uint32_t version);
+	bool ParseFooter(std::span<const std::byte> footer, std::uint64_t footerEnd);
+	bool FindLastFooter(std::uint64_t fileSize);
+	bool LoadIndexFile();
+	bool ReplayJournal();
+	void ResetJournal();
+	void AppendEntry(std::vector<char>& out, const AFPCK_ENTRYINFO& entry) const;
+	void BuildDirectory(std::vector<char>& out) const;
+	void BuildFooter(std::vector<char>& out, const AFPCK_FILEHEADER64& header, std::uint64_t journalOffset,
+		std::uint32_t journalCount, std::uint32_t baseCount) const;
+	bool FitsFormat(std::uint64_t end) const noexcept; // Whether the format can address up to end
+	bool InflateStream(const AFPCK_ENTRYINFO& entry, std::span<std::byte> chunk, const AFPCK_STREAMSINK& sink);
+	bool ReadBlockedFile(const AFPCK_ENTRYINFO& entry, std::span<std::byte> buffer, std::size_t offset, std::size_t& bytesRead);
+	bool ReadSolidFile(const AFPCK_ENTRYINFO& entry, std::span<std::byte> buffer, std::size_t offset, std::size_t& bytesRead);
+	bool ReadRaw(std::uint64_t offset, std::span<std::byte> buffer);
+	bool FetchRaw(std::uint64_t offset, std::size_t length, std::vector<std::byte>& scratch, std::span<const std::byte>& outData);
+	// outStats receives the file's category report, to be added once the payload is written
+	std::span<const std::byte> EncodePayload(std::string_view normalizedName, std::span<const std::byte> fileData, const ACodec* codec,
+		std::uint32_t dictionaryId, AFPCK_ENTRYINFO& entry, AFPCK_CATEGORYSTATS& outStats);
+	void AddCategoryStats(std::string_view normalizedName, const AFPCK_CATEGORYSTATS& delta);
+	const ACodec* SelectCodec(std::string_view normalizedName, std::uint32_t codecId) const;
+	std::uint32_t SelectDictionary(std::string_view normalizedName, const ACodec* codec) const;
+	AEntryBuffer GetDictionary(std::uint32_t dictionaryId); // Loaded on first use, nullptr if missing
+	bool WriteNewEntry(std::string_view fileName, AFPCK_ENTRYINFO& entry, std::span<const std::byte> payload);
+	void AddSharedEntry(std::string_view fileName, const AFPCK_ENTRYINFO& payloadEntry);
+
+	// A small file waiting in AppendFiles() for its solid block to be written
+	struct SOLIDMEMBER
+	{
+		std::string name;
+		std::uint32_t offset; // In the decoded block
+		std::uint32_t length;
+		AHASH128 contentHash;
+		double seconds;       // Worker time before packing, counted once the block is written
+		double policySeconds; // Part of it spent in the compression policy
+		bool duplicate;       // Shares the bytes of an earlier member of the block in dedup mode
+	};
+
+	bool WriteSolidBlock(std::span<const SOLIDMEMBER> members, std::span<const std::byte> blockData, const ACodec& codec,
+		int level, std::vector<std::byte>& scratch, std::uint64_t& outStoredBytes);
+	bool WritePayload(std::span<const std::byte> payload, AFPCK_ENTRYINFO& entry);
+
+	void AddEntry(std::string_view name, AFPCK_ENTRYINFO entry);
+	void EraseEntry(int index);
+	std::uint32_t AddEntryName(std::string_view name);
+	void CompactNamePool();
+	void ToFileEntry(const AFPCK_ENTRYINFO& info, AFPCK_FILEENTRY& outEntry) const;
+
+	// Hash index over case-folded entry names (open addressing, linear probing)
+	struct INDEXSLOT
+	{
+		std::uint64_t hash;
+		std::uint32_t index; // Index into m_fileEntries, EMPTY_SLOT if unused
+	};
+
+	void RebuildIndex();
+	void BuildIndex(std::span<const std::uint64_t> hashes);
+	void IndexInsert(std::uint64_t hash, std::uint32_t index);
+	void IndexErase(std::uint64_t hash, std::uint32_t index);
+	void IndexRelocate(std::uint64_t hash, std::uint32_t oldIndex, std::uint32_t newIndex);
+	int FindEntryIndex(std::string_view trimmedName) const;
+	int FindEntryIndex(std::wstring_view fileName) const;
+	int FindEntryIndexByHash(std::uint64_t hash) const;
+
+	AThreadPool* GetAsyncPool(const wchar_t* caller);
+	void TraceAccess(const AFPCK_ENTRYINFO& entry) const;
+
+	// Free extents of dead payload space below the directory, reused best-fit by new payloads
+	std::uint64_t AllocateExtent(std::uint64_t length);
+	void ReleaseExtent(std::uint64_t offset, std::uint64_t length);
+	void InsertFreeExtent(std::uint64_t offset, std::uint64_t length);
+	void RebuildFreeExtents();
+	void CollectHoles(std::vector<std::pair<std::uint64_t, std::uint64_t>>& outHoles) const;
+
+	// Entries per payload extent, so a payload shared by dedup is freed with its last entry.
+	// Counted from the directory on first use since earlier sessions may have shared payloads.
+	struct PAYLOADREF
+	{
+		std::uint32_t compressedLength; // Tells a recorded dedup candidate from a newer payload at its offset
+		std::uint32_t count;
+	};
+
+	void BuildPayloadRefs();
+	void AddPayloadRef(const AFPCK_ENTRYINFO& entry);
+	void ReleasePayload(const AFPCK_ENTRYINFO& entry);
+	bool FindDuplicate(const AHASH128& contentHash, std::span<const std::byte> fileData, AFPCK_ENTRYINFO& outEntry);
 
 	std::fstream m_packageFile;
-	AFPCK_FILEHEADER m_header{};
+	std::wstring m_packagePath;
+	AFileMapping m_mapping;
+	APositionalFile m_positionalFile;
+	AFPCK_FILEHEADER64 m_header{};
 	AFPCK_OPENMODE m_mode = AFPCK_OPENMODE::AFPCK_OPENEXIST;
-	std::vector<AFPCK_FILEENTRY> m_fileEntries;
+	std::vector<AFPCK_ENTRYINFO> m_fileEntries;
+	std::vector<char> m_namePool;    // Null-terminated entry names, referenced by AFPCK_ENTRYINFO
+	std::size_t m_deadNameBytes = 0; // Pool bytes still held by removed entries
 	std::vector<std::byte> m_compressionBuffer;
+	std::vector<INDEXSLOT> m_index;
+	AEntryCache m_entryCache; // Keyed by entry data offset
+	AEntryCache m_blockCache; // Decoded solid blocks, keyed like m_entryCache
+	mutable AAccessTrace m_accessTrace; // Recorded by const readers such as GetFileView() too
+	std::map<std::uint64_t, std::uint64_t> m_freeExtents;     // Offset -> length
+	std::multimap<std::uint64_t, std::uint64_t> m_freeBySize; // Length -> offset
+	std::vector<std::pair<std::uint64_t, std::uint64_t>> m_pendingFree; // Released since the last save
+	std::uint64_t m_freeBytes = 0;
+	std::unordered_map<std::uint64_t, PAYLOADREF> m_payloadRefs; // Extent key -> live entries, see BuildPayloadRefs()
+	bool m_payloadRefsBuilt = false;
+	std::unordered_multimap<AHASH128, AFPCK_ENTRYINFO, AHASH128_HASHER> m_dedupPayloads; // Content hash -> payload fields
+	std::vector<std::byte> m_dedupBuffer; // Decoded candidate being verified
+	AFPCK_DEDUPSTATS m_dedupStats{};
+	bool m_dedup = false;
+	std::size_t m_solidMaxLength = 0; // See SetSolidBlocks()
+
+	// Commit state; see the journal layout in AFilePackage.cpp
+	std::unordered_set<std::string> m_dirtyNames; // Entries changed since the last commit
+	std::vector<std::pair<std::uint64_t, std::uint64_t>> m_metadataExtents; // Base directory and journal records
+	std::uint32_t m_baseVersion = 0;   // Format of the base directory
+	std::uint32_t m_baseCount = 0;     // Entries in the base directory
+	std::uint64_t m_baseDirBytes = 0;
+	std::uint64_t m_journalOffset = 0; // Newest journal record
+	std::uint32_t m_journalCount = 0;
+	std::uint64_t m_journalBytes = 0;
+	std::uint64_t m_footerOffset = 0;
+	std::uint64_t m_appendOffset = 0;  // End of everything committed or written; new payloads and commits go here
+	std::uint64_t m_committedEnd = 0;  // End of the newest footer
+	std::uint64_t m_packageId = 0;     // From the leading signature; 0 for legacy and unsigned packages
+	std::unique_ptr<AThreadPool> m_asyncPool;
+	std::mutex m_asyncMutex;
+	ACancelToken m_closeToken; // Cancelled by Close() to abandon queued async reads
+	unsigned int m_asyncWorkerCount = 0;
+	std::uint32_t m_defaultCodec = ACODEC_ZLIB;
+	std::unordered_map<std::string, std::uint32_t> m_extensionCodecs;
+	std::unordered_map<std::string, std::uint32_t> m_extensionDictionaries;
+	const ACompressionPolicy* m_compressionPolicy = nullptr;
+	std::unordered_map<std::string, AFPCK_CATEGORYSTATS> m_categoryStats; // By lower-case extension
+	std::array<AEntryBuffer, AFPCK_MAX_DICTIONARY + 1> m_dictionaries; // By id, guarded by m_dictionaryMutex
+	std::mutex m_dictionaryMutex;
 
 	bool m_hasChanged = false;
 	bool m_readOnly = false;
 	bool m_hasSorted = false;
 
-	static constexpr std::uint32_t CURRENT_VERSION = 0x00010003u;
+	static constexpr std::uint32_t CURRENT_VERSION = 0x00010008u;
+	static constexpr std::uint32_t JOURNAL_VERSION = 0x00010006u;
+	static constexpr std::uint32_t LEGACY_VERSION = 0x00010003u;
+	static constexpr std::uint32_t LARGE_VERSION = 0x00020000u;
+	static constexpr std::uint32_t EMPTY_SLOT = 0xFFFFFFFFu;
+	static constexpr std::size_t MAX_NAME_LENGTH = sizeof(AFPCK_FILEENTRY::szFileName) - 1;
+};
+
+// Precomputed lookup key: HashFileName() of the normalized entry name. Built from a literal it is
+// evaluated at compile time, e.g. constexpr AAssetId tank("Models\\Tank.mox"). Names are hashed
+// as UTF-8 bytes; spell non-ASCII literals as u8"" so the hash does not depend on the compiler's
+// execution character set. Lookups by id resolve by hash alone and fail if two names collide.
+struct AAssetId
+{
+	std::uint64_t hash = 0;
+
+	constexpr AAssetId() noexcept = default;
+	constexpr explicit AAssetId(std::string_view utf8Name) noexcept
+		: hash(AFilePackage::HashName(AFilePackage::TrimName(utf8Name))) {}
+	constexpr explicit AAssetId(std::u8string_view utf8Name) noexcept
+		: hash(AFilePackage::HashName(AFilePackage::TrimName(utf8Name))) {}
+
+	static constexpr AAssetId FromHash(std::uint64_t nameHash) noexcept
+	{
+		AAssetId id;
+		id.hash = nameHash;
+		return id;
+	}
+
+	constexpr bool operator==(const AAssetId&) const noexcept = default;
 };
 
+// Mounts packFile read-only at priority 0 in the global mount table, which AFileImage reads through
 bool OpenFilePackage(std::wstring_view packFile);
 bool CloseFilePackage();
-AFilePackage* GetGlobalFilePackage();
+// For lookups only; the mount table's index refers to its entries, so it must not be modified
+const AFilePackage* GetGlobalFilePackage();
 
 #endif
@@ -0,0 +1,14 @@
+#ifndef _AFILESYNC_H_
+#define _AFILESYNC_H_
+
+#include <string_view>
+
+// Forces the data written to the file so far, through any handle, onto the storage device
+// (FlushFileBuffers / fsync). Writes issued after it returns can not reach the disk before them.
+bool AFile_SyncToDisk(std::wstring_view filePath);
+
+// Makes the renames and creations of entries in directoryPath durable (fsync of the directory).
+// A no-op on Windows, where NTFS commits directory changes through its own metadata journal.
+bool AFile_SyncDirectory(std::wstring_view directoryPath);
+
+#endif
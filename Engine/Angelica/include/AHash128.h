@@ -0,0 +1,25 @@
+#ifndef _AHASH128_H_
+#define _AHASH128_H_
+
+#include <span>
+
+// 128-bit content hash
+struct AHASH128
+{
+	std::uint64_t low;
+	std::uint64_t high;
+
+	bool operator==(const AHASH128&) const noexcept = default;
+};
+
+// MurmurHash3 x64/128 of data: fast and well distributed but not cryptographic, so equal hashes
+// only mark candidates that still have to be compared byte for byte.
+AHASH128 AHash128(std::span<const std::byte> data, std::uint32_t seed = 0) noexcept;
+
+// Hasher for unordered containers keyed by AHASH128
+struct AHASH128_HASHER
+{
+	std::size_t operator()(const AHASH128& hash) const noexcept { return static_cast<std::size_t>(hash.low ^ hash.high); }
+};
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _ALZCODEC_H_
+#define _ALZCODEC_H_
+
+#include "ACodec.h"
+
+// Byte-oriented LZ77 codec in the LZ4 block style: a token with 4-bit literal and match
+// lengths, 16-bit offsets, no entropy stage. Decoding is a tight copy loop. The level (1-9)
+// sets how quickly the match search skips ahead through data that does not match.
+class ALZCodec : public ACodec
+{
+public:
+	[[nodiscard]] std::uint32_t GetId() const noexcept override { return ACODEC_LZ; }
+	[[nodiscard]] const wchar_t* GetName() const noexcept override { return L"LZ"; }
+	[[nodiscard]] std::size_t GetCompressBound(std::size_t sourceSize) const noexcept override;
+
+	std::size_t Compress(std::span<const std::byte> source, std::span<std::byte> dest, int level) const override;
+	bool Decompress(std::span<const std::byte> source, std::span<std::byte> dest) const override;
+};
+
+#endif
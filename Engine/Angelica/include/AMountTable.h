@@ -0,0 +1,95 @@
+#ifndef _AMOUNTTABLE_H_
+#define _AMOUNTTABLE_H_
+
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+#include "AFilePackage.h"
+
+// Source a name resolved to in AMountTable::Find()
+struct AMOUNT_LOOKUP
+{
+	AFilePackage* package;        // Winning package, nullptr when a directory wins
+	const AFPCK_ENTRYINFO* entry; // Entry inside package
+	std::wstring diskPath;        // Full path of the file when a directory wins
+	int priority;                 // Priority of the winning mount
+};
+
+// Layered view over several packages and directories. Every mounted name goes into one merged
+// hash index that records the winning source, so a lookup is a single probe however many
+// sources are mounted. Higher priorities shadow lower ones; on equal priority the later mount wins.
+// Directories are scanned when mounted. Mounted packages must not be modified while mounted.
+// Lookups and reads may run on several threads; mounting and unmounting lock them out.
+class AMountTable
+{
+public:
+	AMountTable() = default;
+	~AMountTable();
+
+	AMountTable(const AMountTable&) = delete;
+	AMountTable& operator=(const AMountTable&) = delete;
+
+	// The package is opened with openFlags; the mapped default allows concurrent reads
+	bool MountPackage(std::wstring_view pckPath, int priority, std::uint32_t openFlags = AFPCK_OPEN_MAPPED);
+	bool MountDirectory(std::wstring_view dirPath, int priority);
+	// Unmounting rebuilds the merged index so that shadowed names resurface
+	bool Unmount(std::wstring_view path);
+	void UnmountAll();
+
+	bool Find(std::wstring_view fileName, AMOUNT_LOOKUP& outLookup) const;
+	// By hash alone; fails if two mounted names share the hash
+	bool Find(AAssetId id, AMOUNT_LOOKUP& outLookup) const;
+	// Whole file from the winning source, nullptr if it is not mounted or can not be read;
+	// outFound tells the two apart. Looks the name up and reads it under one lock.
+	AEntryBuffer ReadFile(std::wstring_view fileName, bool* outFound = nullptr) const;
+	AEntryBuffer ReadFile(AAssetId id) const;
+
+	// Package mounted from pckPath, nullptr if there is none
+	[[nodiscard]] AFilePackage* GetPackage(std::wstring_view pckPath) const;
+	[[nodiscard]] std::size_t GetMountCount() const;
+	[[nodiscard]] std::size_t GetFileCount() const; // Distinct names across all mounts
+
+private:
+	struct MOUNT
+	{
+		std::wstring path;
+		int priority;
+		std::uint32_t sequence;                 // Mount order, breaks priority ties
+		std::unique_ptr<AFilePackage> package;  // Set for package mounts
+		std::vector<std::string> names;         // Normalized names of a directory mount
+		std::vector<std::wstring> diskPaths;    // Full paths, parallel to names
+	};
+
+	// Merged index slot (open addressing, linear probing)
+	struct SLOT
+	{
+		std::uint64_t hash;
+		std::uint32_t mount; // Index into m_mounts, EMPTY_SLOT if unused
+		std::uint32_t item;  // Entry index in the package or name index in the directory
+	};
+
+	bool AddMount(std::unique_ptr<MOUNT> mount);
+	void MergeMount(std::uint32_t mountIndex);
+	void RebuildIndex();
+	void Reserve(std::size_t nameCount);
+	std::string_view GetItemName(const MOUNT& mount, std::uint32_t item) const;
+	bool Outranks(const MOUNT& a, const MOUNT& b) const noexcept;
+	const SLOT* FindSlot(std::string_view trimmedName) const;
+	const SLOT* FindSlotByHash(std::uint64_t hash) const;
+	bool FillLookup(const SLOT& slot, AMOUNT_LOOKUP& outLookup) const; // false if the package entry is gone
+	AEntryBuffer ReadSlot(const SLOT& slot) const;
+
+	std::vector<std::unique_ptr<MOUNT>> m_mounts;
+	std::vector<SLOT> m_index;
+	std::size_t m_nameCount = 0;
+	std::uint32_t m_nextSequence = 0;
+	mutable std::shared_mutex m_mutex;
+
+	static constexpr std::uint32_t EMPTY_SLOT = 0xFFFFFFFFu;
+};
+
+// Mount table AFileImage resolves relative file names through before trying the disk
+AMountTable& GetGlobalMountTable();
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef _APOSITIONALFILE_H_
+#define _APOSITIONALFILE_H_
+
+#include <span>
+
+// Read-only file accessed with positional reads (pread / ReadFile + OVERLAPPED offset).
+// There is no shared file cursor, so ReadAt() may be called from several threads at once.
+class APositionalFile
+{
+public:
+	APositionalFile() = default;
+	~APositionalFile();
+
+	APositionalFile(const APositionalFile&) = delete;
+	APositionalFile& operator=(const APositionalFile&) = delete;
+
+	bool Open(std::wstring_view filePath);
+	void Close();
+
+	// Fills the whole buffer from the given absolute offset; fails on short reads
+	bool ReadAt(std::uint64_t offset, std::span<std::byte> buffer) const;
+
+	[[nodiscard]] bool IsOpen() const noexcept;
+	[[nodiscard]] std::uint64_t GetSize() const noexcept { return m_size; }
+
+private:
+#ifdef _WIN32
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+#else
+	int m_fd = -1;
+#endif
+	std::uint64_t m_size = 0;
+};
+
+#endif
@@ -145,6 +145,61 @@ inline std::wstring AString_UTF8ToUnicode(const std::string& utf8) { return AStr
 inline std::string AString_UnicodeToUTF8(const wchar_t* unicode) { return AString_FromWString(unicode, CP_UTF8); }
 inline std::string AString_UnicodeToUTF8(const std::wstring& unicode) { return AString_FromWString(unicode, CP_UTF8); }
 
+// UTF-8 into a caller buffer, without allocating. Unpaired surrogates become U+FFFD as with
+// WideCharToMultiByte. Returns false if the buffer is too small.
+inline bool AString_UnicodeToUTF8(std::wstring_view unicode, char* buffer, size_t bufferSize, size_t& outLength) noexcept
+{
+    size_t length = 0;
+    for (size_t i = 0; i < unicode.size(); ++i)
+    {
+        char32_t cp = static_cast<char32_t>(unicode[i]);
+        if constexpr (sizeof(wchar_t) == 2)
+        {
+            if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < unicode.size() &&
+                unicode[i + 1] >= 0xDC00 && unicode[i + 1] <= 0xDFFF)
+            {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (static_cast<char32_t>(unicode[i + 1]) - 0xDC00);
+                ++i;
+            }
+        }
+
+        if ((cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF)
+            cp = 0xFFFD;
+
+        const size_t units = cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+        if (bufferSize - length < units)
+            return false;
+
+        switch (units)
+        {
+        case 1:
+            buffer[length] = static_cast<char>(cp);
+            break;
+        case 2:
+            buffer[length] = static_cast<char>(0xC0 | (cp >> 6));
+            buffer[length + 1] = static_cast<char>(0x80 | (cp & 0x3F));
+            break;
+        case 3:
+            buffer[length] = static_cast<char>(0xE0 | (cp >> 12));
+            buffer[length + 1] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            buffer[length + 2] = static_cast<char>(0x80 | (cp & 0x3F));
+            break;
+        default:
+            buffer[length] = static_cast<char>(0xF0 | (cp >> 18));
+            buffer[length + 1] = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            buffer[length + 2] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            buffer[length + 3] = static_cast<char>(0x80 | (cp & 0x3F));
+            break;
+        }
+
+        length += units;
+    }
+
+    outLength = length;
+
+    return true;
+}
+
 // CP936 (GBK)
 inline std::wstring AString_CP936ToUnicode(const char* gbk) { return AString_ToWString(gbk, 936); }
 inline std::wstring AString_CP936ToUnicode(const std::string& gbk) { return AString_ToWString(gbk, 936); }
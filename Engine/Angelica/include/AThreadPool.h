@@ -0,0 +1,61 @@
+#ifndef _ATHREADPOOL_H_
+#define _ATHREADPOOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+// Shared cancellation flag for queued work; copies observe the same state
+class ACancelToken
+{
+public:
+	ACancelToken() : m_state(std::make_shared<std::atomic<bool>>(false)) {}
+
+	void Cancel() const noexcept { m_state->store(true, std::memory_order_relaxed); }
+	[[nodiscard]] bool IsCancelled() const noexcept { return m_state->load(std::memory_order_relaxed); }
+
+private:
+	std::shared_ptr<std::atomic<bool>> m_state;
+};
+
+// Fixed-size pool of worker threads running queued tasks in FIFO order
+class AThreadPool
+{
+public:
+	// threadCount == 0 uses one thread per hardware core
+	explicit AThreadPool(unsigned int threadCount = 0);
+	~AThreadPool();
+
+	AThreadPool(const AThreadPool&) = delete;
+	AThreadPool& operator=(const AThreadPool&) = delete;
+
+	void Enqueue(std::function<void()> task);
+
+	template <typename Func>
+	auto Submit(Func&& func) -> std::future<std::invoke_result_t<Func>>
+	{
+		using Result = std::invoke_result_t<Func>;
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Func>(func));
+		auto future = task->get_future();
+		Enqueue([task]() { (*task)(); });
+		return future;
+	}
+
+	[[nodiscard]] unsigned int GetThreadCount() const noexcept { return static_cast<unsigned int>(m_threads.size()); }
+
+private:
+	void WorkerLoop();
+
+	std::vector<std::thread> m_threads;
+	std::deque<std::function<void()>> m_tasks;
+	std::mutex m_mutex;
+	std::condition_variable m_wakeup;
+	bool m_stopping = false;
+};
+
+#endif
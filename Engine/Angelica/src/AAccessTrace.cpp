@@ -0,0 +1,60 @@
+#include "pch.h"
+#include "AAccessTrace.h"
+#include "AFPI.h"
+
+void AAccessTrace::Start()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_start = std::chrono::steady_clock::now();
+    m_phases.assign(1, std::string());
+    m_phase = 0;
+    m_seen.clear();
+    m_records.clear();
+    m_recording.store(true, std::memory_order_relaxed);
+}
+
+bool AAccessTrace::SetPhase(std::string_view phase)
+{
+    if (phase.find_first_of("\t\r\n") != std::string_view::npos)
+    {
+        AFERRLOG(L"AAccessTrace::SetPhase(), Phase names can not contain tabs or line breaks");
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = std::find(m_phases.begin(), m_phases.end(), phase);
+    const auto index = static_cast<std::uint32_t>(it - m_phases.begin());
+    if (it == m_phases.end())
+        m_phases.emplace_back(phase);
+
+    // Re-entering a phase may repeat some of its keys; the repeats are ignored when the trace is used
+    if (index != m_phase)
+    {
+        m_phase = index;
+        m_seen.clear();
+    }
+
+    return true;
+}
+
+void AAccessTrace::Record(std::uint64_t key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_recording.load(std::memory_order_relaxed) || !m_seen.insert(key).second)
+        return;
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start);
+    m_records.push_back({ key, static_cast<std::uint64_t>(elapsed.count()), m_phase });
+}
+
+std::vector<AACCESSTRACE_RECORD> AAccessTrace::GetRecords() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_records;
+}
+
+std::vector<std::string> AAccessTrace::GetPhases() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_phases;
+}
@@ -0,0 +1,148 @@
+#include "pch.h"
+#include "ACodec.h"
+#include "ALZCodec.h"
+#include "zlib.h"
+
+#include <array>
+
+namespace
+{
+    class AZlibCodec : public ACodec
+    {
+    public:
+        std::uint32_t GetId() const noexcept override { return ACODEC_ZLIB; }
+        const wchar_t* GetName() const noexcept override { return L"zlib"; }
+
+        std::size_t GetCompressBound(std::size_t sourceSize) const noexcept override
+        {
+            return compressBound(static_cast<uLong>(sourceSize));
+        }
+
+        std::size_t Compress(std::span<const std::byte> source, std::span<std::byte> dest, int level) const override
+        {
+            uLongf destLen = static_cast<uLongf>(dest.size());
+            int result = compress2(
+                reinterpret_cast<Bytef*>(dest.data()),
+                &destLen,
+                reinterpret_cast<const Bytef*>(source.data()),
+                static_cast<uLong>(source.size()),
+                level
+            );
+
+            return result == Z_OK ? static_cast<std::size_t>(destLen) : 0;
+        }
+
+        bool Decompress(std::span<const std::byte> source, std::span<std::byte> dest) const override
+        {
+            uLongf destLen = static_cast<uLongf>(dest.size());
+            int result = uncompress(
+                reinterpret_cast<Bytef*>(dest.data()),
+                &destLen,
+                reinterpret_cast<const Bytef*>(source.data()),
+                static_cast<uLong>(source.size())
+            );
+
+            return result == Z_OK && destLen == dest.size();
+        }
+    };
+
+    // Per-thread inflate state of ACodec_ZlibDecompress()
+    struct AInflater
+    {
+        z_stream stream{};
+        bool initialized = false;
+
+        ~AInflater()
+        {
+            if (initialized)
+                inflateEnd(&stream);
+        }
+
+        bool Reset()
+        {
+            if (initialized)
+                return inflateReset(&stream) == Z_OK;
+
+            initialized = inflateInit(&stream) == Z_OK;
+            return initialized;
+        }
+    };
+
+    const AZlibCodec g_zlibCodec;
+    const ALZCodec g_lzCodec;
+
+    std::array<const ACodec*, ACODEC_MAXID + 1>& GetCodecTable()
+    {
+        static std::array<const ACodec*, ACODEC_MAXID + 1> table = []() {
+            std::array<const ACodec*, ACODEC_MAXID + 1> codecs{};
+            codecs[ACODEC_ZLIB] = &g_zlibCodec;
+            codecs[ACODEC_LZ] = &g_lzCodec;
+            return codecs;
+        }();
+
+        return table;
+    }
+}
+
+const ACodec* ACodec_Find(std::uint32_t codecId)
+{
+    return codecId <= ACODEC_MAXID ? GetCodecTable()[codecId] : nullptr;
+}
+
+bool ACodec_Register(const ACodec* codec)
+{
+    if (!codec || codec->GetId() > ACODEC_MAXID)
+        return false;
+
+    // Built-in ids are fixed so existing packages always decode the same way
+    const std::uint32_t id = codec->GetId();
+    if (id == ACODEC_ZLIB || id == ACODEC_LZ)
+        return false;
+
+    GetCodecTable()[id] = codec;
+
+    return true;
+}
+
+std::size_t ACodec_ZlibCompress(std::span<const std::byte> source, std::span<std::byte> dest, int level, std::span<const std::byte> dictionary)
+{
+    z_stream stream{};
+    if (deflateInit(&stream, level) != Z_OK)
+        return 0;
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<std::byte*>(source.data()));
+    stream.avail_in = static_cast<uInt>(source.size());
+    stream.next_out = reinterpret_cast<Bytef*>(dest.data());
+    stream.avail_out = static_cast<uInt>(dest.size());
+
+    int result = deflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(dictionary.data()), static_cast<uInt>(dictionary.size()));
+    if (result == Z_OK)
+        result = deflate(&stream, Z_FINISH);
+
+    const std::size_t destLen = stream.total_out;
+    deflateEnd(&stream);
+
+    return result == Z_STREAM_END ? destLen : 0;
+}
+
+bool ACodec_ZlibDecompress(std::span<const std::byte> source, std::span<std::byte> dest, std::span<const std::byte> dictionary)
+{
+    // Reset instead of rebuilt per call, so small entries do not pay for a fresh window each
+    thread_local AInflater t_inflater;
+    if (!t_inflater.Reset())
+        return false;
+
+    z_stream& stream = t_inflater.stream;
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<std::byte*>(source.data()));
+    stream.avail_in = static_cast<uInt>(source.size());
+    stream.next_out = reinterpret_cast<Bytef*>(dest.data());
+    stream.avail_out = static_cast<uInt>(dest.size());
+
+    // inflate() asks for the dictionary once it has read the stream header
+    int result = inflate(&stream, Z_FINISH);
+    if (result == Z_NEED_DICT &&
+        inflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(dictionary.data()), static_cast<uInt>(dictionary.size())) == Z_OK)
+        result = inflate(&stream, Z_FINISH);
+
+    return result == Z_STREAM_END && stream.total_out == dest.size();
+}
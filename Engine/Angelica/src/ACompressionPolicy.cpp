@@ -0,0 +1,144 @@
+#include "pch.h"
+#include "ACompressionPolicy.h"
+
+#include <array>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+    constexpr std::size_t SAMPLE_COUNT = 4;       // Slices spread over the file for the entropy estimate
+    constexpr std::size_t SAMPLE_SIZE = 0x1000;
+    constexpr int TRIAL_LEVEL = 1;
+
+    // Formats whose data is compressed already
+    constexpr std::string_view COMPRESSED_EXTENSIONS[] = { "ogg", "mp3", "jpg", "jpeg", "png", "zip", "gz", "7z", "mp4", "webm", "bik" };
+
+    thread_local std::vector<std::byte> t_trialScratch;
+
+    std::string NormalizeExtension(std::string_view extension)
+    {
+        if (!extension.empty() && extension.front() == '.')
+            extension.remove_prefix(1);
+
+        std::string key(extension);
+        std::transform(key.begin(), key.end(), key.begin(),
+            [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+        return key;
+    }
+
+    std::string_view GetExtension(std::string_view name)
+    {
+        const std::size_t dot = name.find_last_of(".\\/");
+        return dot != std::string_view::npos && name[dot] == '.' ? name.substr(dot + 1) : std::string_view();
+    }
+
+    // Order-0 entropy in bits per byte of a few slices spread over the data
+    double SampleEntropy(std::span<const std::byte> data)
+    {
+        std::array<std::uint32_t, 256> counts{};
+        std::size_t total = 0;
+        const std::size_t stride = data.size() / SAMPLE_COUNT;
+        for (std::size_t sample = 0; sample < SAMPLE_COUNT; ++sample)
+        {
+            const std::span<const std::byte> slice = data.subspan(sample * stride, std::min(SAMPLE_SIZE, data.size() - sample * stride));
+            for (std::byte value : slice)
+                ++counts[static_cast<std::uint8_t>(value)];
+
+            total += slice.size();
+        }
+
+        double entropy = 0.0;
+        for (std::uint32_t count : counts)
+        {
+            if (count > 0)
+            {
+                const double p = static_cast<double>(count) / static_cast<double>(total);
+                entropy -= p * std::log2(p);
+            }
+        }
+
+        return entropy;
+    }
+}
+
+AAdaptiveCompressionPolicy::AAdaptiveCompressionPolicy()
+{
+    for (std::string_view extension : COMPRESSED_EXTENSIONS)
+        m_rules.emplace(extension, ACOMPRESSIONRULE{ ACOMPRESSION_STORE, ACOMPRESSION_LEVEL_AUTO });
+}
+
+void AAdaptiveCompressionPolicy::SetExtensionRule(std::string_view extension, ACOMPRESSIONRULE rule)
+{
+    m_rules[NormalizeExtension(extension)] = rule;
+}
+
+void AAdaptiveCompressionPolicy::RemoveExtensionRule(std::string_view extension)
+{
+    m_rules.erase(NormalizeExtension(extension));
+}
+
+void AAdaptiveCompressionPolicy::SetSizeLevel(std::size_t minSize, int level)
+{
+    auto it = std::lower_bound(m_sizeLevels.begin(), m_sizeLevels.end(), std::make_pair(minSize, std::numeric_limits<int>::min()));
+    if (it != m_sizeLevels.end() && it->first == minSize)
+        it->second = level;
+    else
+        m_sizeLevels.insert(it, { minSize, level });
+}
+
+void AAdaptiveCompressionPolicy::SetThresholds(double storeEntropy, double trialEntropy, std::size_t trialBytes, double minTrialSavings)
+{
+    m_storeEntropy = storeEntropy;
+    m_trialEntropy = trialEntropy;
+    m_trialBytes = trialBytes;
+    m_minTrialSavings = minTrialSavings;
+}
+
+ACOMPRESSIONDECISION AAdaptiveCompressionPolicy::Decide(std::string_view normalizedName, std::span<const std::byte> fileData, const ACodec& codec, int baseLevel) const
+{
+    const ACOMPRESSIONRULE* rule = nullptr;
+    if (!m_rules.empty())
+    {
+        auto it = m_rules.find(NormalizeExtension(GetExtension(normalizedName)));
+        if (it != m_rules.end())
+            rule = &it->second;
+    }
+
+    const int level = SelectLevel(rule, fileData.size(), baseLevel);
+    if (rule && rule->mode != ACOMPRESSION_AUTO)
+        return { rule->mode == ACOMPRESSION_ALWAYS, level };
+
+    // Small files cost little to compress outright
+    if (fileData.size() <= m_trialBytes)
+        return { true, level };
+
+    const double entropy = SampleEntropy(fileData);
+    if (entropy >= m_storeEntropy)
+        return { false, level };
+
+    if (entropy < m_trialEntropy)
+        return { true, level };
+
+    // In between, a fast compression of the prefix tells whether the rest is worth it
+    const std::span<const std::byte> prefix = fileData.first(m_trialBytes);
+    const std::size_t bound = codec.GetCompressBound(prefix.size());
+    if (t_trialScratch.size() < bound)
+        t_trialScratch.resize(bound);
+
+    const std::size_t trialLength = codec.Compress(prefix, std::span<std::byte>(t_trialScratch.data(), bound), TRIAL_LEVEL);
+    const double savings = trialLength > 0 ? 1.0 - static_cast<double>(trialLength) / static_cast<double>(prefix.size()) : 0.0;
+
+    return { savings >= m_minTrialSavings, level };
+}
+
+int AAdaptiveCompressionPolicy::SelectLevel(const ACOMPRESSIONRULE* rule, std::size_t fileSize, int baseLevel) const
+{
+    if (rule && rule->level != ACOMPRESSION_LEVEL_AUTO)
+        return rule->level;
+
+    // Largest size level the file reaches
+    auto it = std::upper_bound(m_sizeLevels.begin(), m_sizeLevels.end(), std::make_pair(fileSize, std::numeric_limits<int>::max()));
+    return it != m_sizeLevels.begin() ? std::prev(it)->second : baseLevel;
+}
@@ -0,0 +1,112 @@
+#include "pch.h"
+#include "ADictionaryTrainer.h"
+
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace
+{
+    constexpr std::size_t DMER_SIZE = 8;     // Substring length counted across samples
+    constexpr std::size_t SEGMENT_SIZE = 64; // Dictionary pieces are cut from the samples at this size
+
+    struct SEGMENT
+    {
+        const std::byte* data;
+        std::size_t length;
+    };
+
+    std::uint64_t LoadDmer(const std::byte* data)
+    {
+        std::uint64_t dmer = 0;
+        std::memcpy(&dmer, data, DMER_SIZE);
+        return dmer;
+    }
+}
+
+std::vector<std::byte> ADictionary_Train(std::span<const std::span<const std::byte>> samples, std::size_t maxBytes)
+{
+    maxBytes = std::min(maxBytes, ADICTIONARY_MAXSIZE);
+
+    // Number of samples each d-mer occurs in; a sample repeating itself tells nothing about the others
+    std::unordered_map<std::uint64_t, std::uint32_t> frequency;
+    std::unordered_set<std::uint64_t> seen;
+    std::vector<SEGMENT> segments;
+    for (std::span<const std::byte> sample : samples)
+    {
+        seen.clear();
+        for (std::size_t i = 0; i + DMER_SIZE <= sample.size(); ++i)
+        {
+            const std::uint64_t dmer = LoadDmer(sample.data() + i);
+            if (seen.insert(dmer).second)
+                ++frequency[dmer];
+        }
+
+        for (std::size_t start = 0; start + DMER_SIZE <= sample.size(); start += SEGMENT_SIZE)
+            segments.push_back({ sample.data() + start, std::min(SEGMENT_SIZE, sample.size() - start) });
+    }
+
+    // Summed sample counts of the distinct shared d-mers a segment holds that no picked segment covers yet
+    auto score = [&](const SEGMENT& segment) {
+        std::uint64_t total = 0;
+        seen.clear();
+        for (std::size_t i = 0; i + DMER_SIZE <= segment.length; ++i)
+        {
+            const std::uint64_t dmer = LoadDmer(segment.data + i);
+            auto it = frequency.find(dmer);
+            if (it != frequency.end() && it->second > 1 && seen.insert(dmer).second)
+                total += it->second;
+        }
+
+        return total;
+    };
+
+    std::priority_queue<std::pair<std::uint64_t, std::size_t>> queue;
+    for (std::size_t i = 0; i < segments.size(); ++i)
+    {
+        if (const std::uint64_t initial = score(segments[i]); initial > 0)
+            queue.emplace(initial, i);
+    }
+
+    // Lazy greedy: scores only drop as segments are picked, so a popped segment whose fresh score
+    // still beats the next stale one is the best
+    std::vector<std::size_t> picked;
+    std::size_t pickedBytes = 0;
+    while (!queue.empty() && pickedBytes < maxBytes)
+    {
+        const std::size_t index = queue.top().second;
+        queue.pop();
+
+        const std::uint64_t current = score(segments[index]);
+        if (current == 0)
+            continue;
+
+        if (!queue.empty() && current < queue.top().first)
+        {
+            queue.emplace(current, index);
+            continue;
+        }
+
+        picked.push_back(index);
+        pickedBytes += segments[index].length;
+
+        const SEGMENT& segment = segments[index];
+        for (std::size_t i = 0; i + DMER_SIZE <= segment.length; ++i)
+        {
+            auto it = frequency.find(LoadDmer(segment.data + i));
+            if (it != frequency.end())
+                it->second = 0;
+        }
+    }
+
+    // Best segments last, nearest to the data being compressed
+    std::vector<std::byte> dictionary;
+    dictionary.reserve(pickedBytes);
+    for (auto it = picked.rbegin(); it != picked.rend(); ++it)
+        dictionary.insert(dictionary.end(), segments[*it].data, segments[*it].data + segments[*it].length);
+
+    if (dictionary.size() > maxBytes)
+        dictionary.erase(dictionary.begin(), dictionary.end() - static_cast<std::ptrdiff_t>(maxBytes));
+
+    return dictionary;
+}
@@ -0,0 +1,112 @@
+#include "pch.h"
+#include "AEntryCache.h"
+
+void AEntryCache::SetBudget(std::size_t byteBudget)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_byteBudget = byteBudget;
+    EvictTo(byteBudget);
+}
+
+std::size_t AEntryCache::GetBudget() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_byteBudget;
+}
+
+bool AEntryCache::IsEnabled() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_byteBudget != 0;
+}
+
+AEntryBuffer AEntryCache::Find(std::uint64_t key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_nodes.find(key);
+    if (it == m_nodes.end())
+    {
+        ++m_misses;
+        return nullptr;
+    }
+
+    ++m_hits;
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+
+    return it->second->buffer;
+}
+
+void AEntryCache::Insert(std::uint64_t key, AEntryBuffer buffer)
+{
+    if (!buffer)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const std::size_t size = buffer->size();
+    if (size > m_byteBudget)
+        return;
+
+    // Another thread may have decoded the same entry in the meantime
+    auto it = m_nodes.find(key);
+    if (it != m_nodes.end())
+    {
+        m_bytesUsed -= it->second->buffer->size();
+        m_lru.erase(it->second);
+        m_nodes.erase(it);
+    }
+
+    EvictTo(m_byteBudget - size);
+
+    m_lru.push_front(NODE{ key, std::move(buffer) });
+    m_nodes.emplace(key, m_lru.begin());
+    m_bytesUsed += size;
+}
+
+void AEntryCache::Erase(std::uint64_t key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_nodes.find(key);
+    if (it == m_nodes.end())
+        return;
+
+    m_bytesUsed -= it->second->buffer->size();
+    m_lru.erase(it->second);
+    m_nodes.erase(it);
+}
+
+void AEntryCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_lru.clear();
+    m_nodes.clear();
+    m_bytesUsed = 0;
+}
+
+AENTRYCACHE_STATS AEntryCache::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return AENTRYCACHE_STATS{ m_hits, m_misses, m_evictions, m_bytesUsed, m_nodes.size(), m_byteBudget };
+}
+
+void AEntryCache::ResetStats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_hits = 0;
+    m_misses = 0;
+    m_evictions = 0;
+}
+
+void AEntryCache::EvictTo(std::size_t byteLimit)
+{
+    while (m_bytesUsed > byteLimit && !m_lru.empty())
+    {
+        NODE& victim = m_lru.back();
+        m_bytesUsed -= victim.buffer->size();
+        m_nodes.erase(victim.key);
+        m_lru.pop_back();
+        ++m_evictions;
+    }
+}
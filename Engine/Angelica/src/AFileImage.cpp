@@ -1,6 +1,6 @@
 #include "pch.h"
 #include "AFileImage.h"
-#include "AFilePackage.h"
+#include "AMountTable.h"
 #include "AFI.h"
 #include "AFPI.h"
 
@@ -71,7 +71,8 @@ bool AFileImage::ResetPointer()
 bool AFileImage::Close()
 {
     m_currentPos = 0;
-    m_fileImage.clear();
+    m_imageBuffer.reset();
+    m_fileImage = {};
     m_isOpen = false;
 
     return true;
@@ -138,22 +139,23 @@ bool AFileImage::Init(std::wstring_view fullPath)
     m_fileName = fullPath;
     m_relativeName = AFileMod_GetRelativePath(fullPath);
 
-    // Try to load from global package first (legacy compatibility)
-    extern AFilePackage* g_pAFilePackage;
-    if (g_pAFilePackage)
+    // Mounted packages and directories first, including the one OpenFilePackage() opened.
+    // Package entries come from the entry cache without a copy when it is enabled.
+    AMountTable& mounts = GetGlobalMountTable();
+    if (mounts.GetMountCount() > 0)
     {
-        AFPCK_FILEENTRY entry;
-        if (g_pAFilePackage->GetFileEntry(m_relativeName, entry))
+        bool found = false;
+        m_imageBuffer = mounts.ReadFile(m_relativeName, &found);
+        if (found)
         {
-            m_fileImage.resize(entry.dwLength);
-            size_t bytesRead = 0;
-            if (!g_pAFilePackage->ReadFile(entry, std::span<std::byte>(reinterpret_cast<std::byte*>(
-                m_fileImage.data()), m_fileImage.size()), 0, bytesRead))
+            if (!m_imageBuffer)
             {
-                AFERRLOG(L"AFileImage::Init(), Error reading file [{}] from package!", m_relativeName);
+                AFERRLOG(L"AFileImage::Init(), Error reading file [{}] from the mounted sources!", m_relativeName);
                 return false;
             }
 
+            m_fileImage = *m_imageBuffer;
+
             return true;
         }
     }
@@ -175,9 +177,9 @@ bool AFileImage::Init(std::wstring_view fullPath)
         return false;
     }
 
-    m_fileImage.resize(fileSize);
+    auto fileBuffer = std::make_shared<std::vector<std::byte>>(fileSize);
     file.seekg(0, std::ios::beg);
-    file.read(reinterpret_cast<char*>(m_fileImage.data()), fileSize);
+    file.read(reinterpret_cast<char*>(fileBuffer->data()), fileSize);
 
     if (file.gcount() != static_cast<std::streamsize>(fileSize))
     {
@@ -185,12 +187,22 @@ bool AFileImage::Init(std::wstring_view fullPath)
         return false;
     }
 
+    m_imageBuffer = std::move(fileBuffer);
+    m_fileImage = *m_imageBuffer;
+
     return true;
 }
 
+const std::vector<std::byte>& AFileImage::GetFileBuffer() const noexcept
+{
+    static const std::vector<std::byte> empty;
+    return m_imageBuffer ? *m_imageBuffer : empty;
+}
+
 bool AFileImage::Release()
 {
-    m_fileImage.clear();
+    m_imageBuffer.reset();
+    m_fileImage = {};
     m_currentPos = 0;
     return true;
 }
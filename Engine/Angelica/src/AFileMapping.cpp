@@ -0,0 +1,138 @@
+#include "pch.h"
+#include "AFileMapping.h"
+#include "AFPI.h"
+
+#include <limits>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+AFileMapping::~AFileMapping()
+{
+    Close();
+}
+
+#ifdef _WIN32
+
+bool AFileMapping::Open(std::wstring_view filePath)
+{
+    Close();
+
+    std::wstring path(filePath);
+    m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        AFERRLOG(L"AFileMapping::Open(), Can not open file [{}]", filePath);
+        return false;
+    }
+
+    LARGE_INTEGER fileSize{};
+    if (!GetFileSizeEx(m_file, &fileSize) || fileSize.QuadPart <= 0 ||
+        static_cast<std::uint64_t>(fileSize.QuadPart) > std::numeric_limits<std::size_t>::max())
+    {
+        AFERRLOG(L"AFileMapping::Open(), Invalid file size for [{}]", filePath);
+        Close();
+        return false;
+    }
+
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_mapping)
+    {
+        AFERRLOG(L"AFileMapping::Open(), CreateFileMapping failed for [{}]", filePath);
+        Close();
+        return false;
+    }
+
+    m_data = static_cast<const std::byte*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_data)
+    {
+        AFERRLOG(L"AFileMapping::Open(), MapViewOfFile failed for [{}]", filePath);
+        Close();
+        return false;
+    }
+
+    m_size = static_cast<std::size_t>(fileSize.QuadPart);
+
+    return true;
+}
+
+void AFileMapping::Close()
+{
+    if (m_data)
+        UnmapViewOfFile(m_data);
+
+    if (m_mapping)
+        CloseHandle(m_mapping);
+
+    if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+
+    m_data = nullptr;
+    m_mapping = nullptr;
+    m_file = INVALID_HANDLE_VALUE;
+    m_size = 0;
+}
+
+#else
+
+bool AFileMapping::Open(std::wstring_view filePath)
+{
+    Close();
+
+    std::filesystem::path path(filePath);
+    m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0)
+    {
+        AFERRLOG(L"AFileMapping::Open(), Can not open file [{}]", filePath);
+        return false;
+    }
+
+    struct stat st{};
+    if (::fstat(m_fd, &st) != 0 || st.st_size <= 0)
+    {
+        AFERRLOG(L"AFileMapping::Open(), Invalid file size for [{}]", filePath);
+        Close();
+        return false;
+    }
+
+    void* data = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED)
+    {
+        AFERRLOG(L"AFileMapping::Open(), mmap failed for [{}]", filePath);
+        Close();
+        return false;
+    }
+
+    m_data = static_cast<const std::byte*>(data);
+    m_size = static_cast<std::size_t>(st.st_size);
+
+    return true;
+}
+
+void AFileMapping::Close()
+{
+    if (m_data)
+        ::munmap(const_cast<std::byte*>(m_data), m_size);
+
+    if (m_fd >= 0)
+        ::close(m_fd);
+
+    m_data = nullptr;
+    m_fd = -1;
+    m_size = 0;
+}
+
+#endif
+
+std::span<const std::byte> AFileMapping::GetRange(std::uint64_t offset, std::uint64_t length) const noexcept
+{
+    if (!m_data || offset > m_size || length > m_size - offset)
+        return {};
+
+    return { m_data + offset, static_cast<std::size_t>(length) };
+}
@@ -1,21 +1,351 @@
 #include "pch.h"
 #include "AFilePackage.h"
+#include "ACodec.h"
+#include "ADictionaryTrainer.h"
+#include "AFileSync.h"
 #include "AFPI.h"
+#include "AMountTable.h"
 #include "AStringConv.h"
+#include "AThreadPool.h"
 #include "zlib.h"
 
+#include <chrono>
+#include <deque>
+#include <random>
+
 namespace
 {
-    std::unique_ptr<AFilePackage> g_globalPackage;
+    std::wstring g_globalPackagePath; // Mounted in the global mount table by OpenFilePackage()
+
+    // Per-thread read staging, so reads never share scratch memory between threads
+    thread_local std::vector<std::byte> t_compressedScratch;
+    thread_local std::vector<std::byte> t_tableScratch;
+    thread_local std::vector<std::byte> t_blockScratch;
+    thread_local std::vector<std::byte> t_runScratch;
+
+    // Package bytes already read by ReadFiles(); raw fetches inside it are served from memory
+    thread_local std::uint64_t t_stagedOffset = 0;
+    thread_local std::span<const std::byte> t_stagedData;
+
+    constexpr std::size_t BLOCK_SIZE = 0x10000;         // Uncompressed size of one block
+    constexpr std::size_t BLOCKED_MIN_LENGTH = 0x40000; // Entries at least this large are block-compressed
+    constexpr std::size_t SOLID_BLOCK_SIZE = 0x10000;   // Decoded size limit of a solid block; offsets in it fit AFPCK_ENTRY_SOLID_OFFSET_MASK
+    constexpr std::size_t SOLID_CACHE_BUDGET = 0x400000; // Default budget of the decoded solid block cache
+    constexpr std::uint64_t MAX_COALESCED_READ = 0x1000000; // Upper bound of one merged ReadFiles() read
+    constexpr std::size_t COMPACT_CHUNK_SIZE = 0x100000;    // Copy buffer of Compact()
+    constexpr std::size_t DIRECTORY_READ_SIZE = 0x100000;   // Directory bytes fetched per read by LoadEntries()
+    constexpr std::size_t INDEX_BUILD_BUCKETS = 4096;       // Slot ranges BuildIndex() fills one at a time
+
+    // Directory journal, version 0x00010006 and later. A commit appends either a full directory or a
+    // record of the entries changed since the last commit, followed by a new footer:
+    //   record: magic, previous record offset, op count, body length, body, CRC-32 of all preceding fields
+    //   op:     uint8 JOURNAL_PUT + directory entry, or uint8 JOURNAL_REMOVE + name length + name
+    //   footer: AFPCK_FILEHEADER, latest record offset, record count, CRC-32, base entry count, version
+    // The footer CRC covers the footer with its CRC field zeroed. Payloads are written before the
+    // record and the record before the footer, so the last intact footer is always a consistent commit.
+    // Version 0x00020000 has the same layout with AFPCK_FILEHEADER64 in the footer and 64-bit record
+    // offsets, and directory entries hold offset, length and compressed length as 64-bit values.
+    //
+    // Packages created or compacted in these formats start with a PACKAGESIGNATURE, and their footer
+    // CRCs are seeded with its package id. LoadEntries() searches for the last intact footer only in
+    // signed packages, and the seed keeps the search off the footers of packages stored as payloads.
+    // Packages upgraded in place from a legacy version are unsigned until compacted.
+    constexpr std::uint32_t JOURNAL_MAGIC = 0x4C4E524Au; // 'JRNL'
+    constexpr std::uint64_t NO_RECORD = ~0ull;
+    constexpr std::uint32_t LEGACY_NO_RECORD = 0xFFFFFFFFu;
+    constexpr std::uint8_t JOURNAL_PUT = 1;
+    constexpr std::uint8_t JOURNAL_REMOVE = 2;
+    constexpr std::size_t RECORD_HEADER_SIZE = 4 * sizeof(std::uint32_t);
+    constexpr std::size_t LARGE_RECORD_HEADER_SIZE = 3 * sizeof(std::uint32_t) + sizeof(std::uint64_t);
+    constexpr std::size_t FOOTER_SIZE = sizeof(AFPCK_FILEHEADER) + 3 * sizeof(std::uint32_t) + sizeof(int) + sizeof(std::uint32_t);
+    constexpr std::size_t LEGACY_FOOTER_SIZE = sizeof(AFPCK_FILEHEADER) + sizeof(int) + sizeof(std::uint32_t);
+    constexpr std::size_t LARGE_FOOTER_SIZE = sizeof(AFPCK_FILEHEADER64) + sizeof(std::uint64_t) + 2 * sizeof(std::uint32_t) + sizeof(int) + sizeof(std::uint32_t);
+    constexpr std::size_t FOOTER_CRC_OFFSET = sizeof(AFPCK_FILEHEADER) + 2 * sizeof(std::uint32_t);
+    constexpr std::size_t LARGE_FOOTER_CRC_OFFSET = sizeof(AFPCK_FILEHEADER64) + sizeof(std::uint64_t) + sizeof(std::uint32_t);
+    constexpr std::size_t LARGE_ENTRY_FIELD_BYTES = 3 * sizeof(std::uint64_t) + sizeof(std::uint32_t);
+    constexpr std::uint64_t MAX_LEGACY_SIZE = 0xFFFFFFFFull; // Offsets of the other versions are 32-bit
+    constexpr std::uint32_t MAX_JOURNAL_RECORDS = 1024;    // Fold into a full directory beyond this
+    constexpr std::uint64_t JOURNAL_SLACK_BYTES = 0x10000; // Journal bytes allowed on top of half the base directory
+
+    constexpr std::uint32_t SIGNATURE_MAGIC = 0x4A4B5046u; // 'FPKJ'
+
+    struct PACKAGESIGNATURE
+    {
+        std::uint32_t magic;
+        std::uint32_t idCrc;     // CRC-32 of packageId, so payload bytes at offset 0 are not taken for a signature
+        std::uint64_t packageId; // Random, never 0
+    };
+    constexpr std::size_t SIGNATURE_SIZE = sizeof(PACKAGESIGNATURE);
+
+    // Index sidecar written by SaveIndex(): INDEXFILEHEADER, entries, hash slots, metadata extents,
+    // free extents, name pool. It is used only while the package still has the size, write time and footer it was
+    // stamped with; every commit appends a new footer, so the footer CRC pins the directory it describes.
+    // Records are stored field by field without padding, so equal directories give byte-identical files.
+    constexpr std::uint32_t INDEX_FILE_MAGIC = 0x58444941u; // 'AIDX'
+    constexpr std::uint32_t INDEX_FILE_VERSION = 3;
+    constexpr std::size_t INDEX_ENTRY_SIZE = 28;  // dwOffset, dwLength, dwCompressedLength, dwFlags, dwNameOffset, dwNameLength
+    constexpr std::size_t INDEX_SLOT_SIZE = 12;   // hash, index
+    constexpr std::size_t INDEX_EXTENT_SIZE = 16; // offset, length
+
+    struct INDEXFILEHEADER
+    {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint64_t packageSize; // Committed end of the package
+        std::int64_t packageTime;  // Last write time of the package
+        std::uint32_t footerCrc;   // CRC-32 of the package footer
+        std::uint32_t entryCount;
+        std::uint64_t slotCount;
+        std::uint64_t namePoolBytes;
+        std::uint32_t extentCount; // Metadata extents
+        std::uint32_t holeCount;   // Free extents
+        std::uint64_t baseDirBytes;
+        std::uint64_t journalBytes;
+    };
+    static_assert(sizeof(INDEXFILEHEADER) == 72, "The index header must not contain padding");
+
+    template <typename T>
+    void AppendValue(std::vector<char>& out, const T& value)
+    {
+        const char* bytes = reinterpret_cast<const char*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    template <typename T>
+    bool TakeValue(std::span<const std::byte>& data, T& value)
+    {
+        if (data.size() < sizeof(T))
+            return false;
+
+        std::memcpy(&value, data.data(), sizeof(T));
+        data = data.subspan(sizeof(T));
+
+        return true;
+    }
+
+    // Identifies a payload extent for the entry cache and the payload refcounts. Live payloads do not
+    // overlap, so the offset is enough once an empty payload is told apart from one at the same offset.
+    std::uint64_t PayloadKey(const AFPCK_ENTRYINFO& entry)
+    {
+        return (entry.dwOffset << 1) | (entry.dwCompressedLength == 0 ? 1u : 0u);
+    }
+
+    AFPCK_FILEHEADER64 WidenHeader(const AFPCK_FILEHEADER& header)
+    {
+        AFPCK_FILEHEADER64 wide{};
+        wide.dwVersion = header.dwVersion;
+        wide.dwEntryOffset = header.dwEntryOffset;
+        std::memcpy(wide.szDescription, header.szDescription, sizeof(wide.szDescription));
+        return wide;
+    }
+
+    AFPCK_FILEHEADER NarrowHeader(const AFPCK_FILEHEADER64& header)
+    {
+        AFPCK_FILEHEADER narrow{};
+        narrow.dwVersion = header.dwVersion;
+        narrow.dwEntryOffset = static_cast<std::uint32_t>(header.dwEntryOffset);
+        std::memcpy(narrow.szDescription, header.szDescription, sizeof(narrow.szDescription));
+        return narrow;
+    }
+
+    // Directory entry fields behind the name: offset, length, compressed length and, from version
+    // 0x00010004, flags. Large packages store them 64-bit; an entry itself stays below 4 GB.
+    bool TakeEntryFields(std::span<const std::byte>& data, bool large, bool hasFlags, AFPCK_ENTRYINFO& entry)
+    {
+        entry.dwFlags = 0;
+        if (!large)
+        {
+            std::uint32_t offset = 0;
+            if (!TakeValue(data, offset) || !TakeValue(data, entry.dwLength) || !TakeValue(data, entry.dwCompressedLength) ||
+                (hasFlags && !TakeValue(data, entry.dwFlags)))
+                return false;
+
+            entry.dwOffset = offset;
+            return true;
+        }
+
+        std::uint64_t length = 0;
+        std::uint64_t compressedLength = 0;
+        if (!TakeValue(data, entry.dwOffset) || !TakeValue(data, length) || !TakeValue(data, compressedLength) ||
+            !TakeValue(data, entry.dwFlags) || length > 0xFFFFFFFFu || compressedLength > 0xFFFFFFFFu)
+            return false;
+
+        entry.dwLength = static_cast<std::uint32_t>(length);
+        entry.dwCompressedLength = static_cast<std::uint32_t>(compressedLength);
+
+        return true;
+    }
+
+    std::uint32_t Crc32(const void* data, std::size_t length, std::uint32_t seed = 0)
+    {
+        return static_cast<std::uint32_t>(crc32(seed, static_cast<const Bytef*>(data), static_cast<uInt>(length)));
+    }
+
+    // Footer CRC seed of a package; 0 for unsigned packages
+    std::uint32_t FooterSeed(std::uint64_t packageId)
+    {
+        return static_cast<std::uint32_t>(packageId ^ (packageId >> 32));
+    }
+
+    // A packageId of 0 draws a new random id
+    PACKAGESIGNATURE MakeSignature(std::uint64_t packageId)
+    {
+        PACKAGESIGNATURE signature{};
+        signature.magic = SIGNATURE_MAGIC;
+        signature.packageId = packageId;
+        if (signature.packageId == 0)
+        {
+            std::random_device device;
+            while (signature.packageId == 0)
+                signature.packageId = (static_cast<std::uint64_t>(device()) << 32) | device();
+        }
+
+        signature.idCrc = Crc32(&signature.packageId, sizeof(signature.packageId));
+
+        return signature;
+    }
+
+    bool IsSignature(const PACKAGESIGNATURE& signature)
+    {
+        return signature.magic == SIGNATURE_MAGIC && signature.packageId != 0 &&
+            signature.idCrc == Crc32(&signature.packageId, sizeof(signature.packageId));
+    }
+
+    bool FindStaged(std::uint64_t offset, std::size_t length, std::span<const std::byte>& outData)
+    {
+        if (t_stagedData.empty() || offset < t_stagedOffset || offset - t_stagedOffset > t_stagedData.size() ||
+            length > t_stagedData.size() - (offset - t_stagedOffset))
+            return false;
+
+        outData = t_stagedData.subspan(static_cast<std::size_t>(offset - t_stagedOffset), length);
+
+        return true;
+    }
+
+    // Compresses fileData into outBuffer and fills in the entry lengths and flags. A one-stream zlib
+    // payload is primed with the dictionary when dictionaryId is not 0. Returns the bytes to store,
+    // which is fileData itself when compression does not pay off.
+    std::span<const std::byte> EncodePayload(std::span<const std::byte> fileData, const ACodec& codec, int level, std::vector<std::byte>& outBuffer,
+        AFPCK_ENTRYINFO& entry, std::uint32_t dictionaryId = 0, std::span<const std::byte> dictionary = {})
+    {
+        entry.dwLength = static_cast<std::uint32_t>(fileData.size());
+        entry.dwCompressedLength = entry.dwLength;
+        entry.dwFlags = 0;
+
+        if (fileData.size() >= BLOCKED_MIN_LENGTH)
+        {
+            // Large entries are compressed as independent blocks so they can be read at any offset
+            const std::size_t blockCount = (fileData.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            const std::size_t dataStart = 2 * sizeof(std::uint32_t) + blockCount * sizeof(std::uint32_t);
+            const std::size_t bound = dataStart + blockCount * codec.GetCompressBound(BLOCK_SIZE);
+            if (outBuffer.size() < bound)
+                outBuffer.resize(bound);
+
+            std::byte* out = outBuffer.data();
+            const std::uint32_t blockSize = BLOCK_SIZE;
+            const std::uint32_t count = static_cast<std::uint32_t>(blockCount);
+            std::memcpy(out, &blockSize, sizeof(blockSize));
+            std::memcpy(out + sizeof(blockSize), &count, sizeof(count));
+
+            std::size_t cursor = dataStart;
+            for (std::size_t block = 0; block < blockCount; ++block)
+            {
+                const std::size_t rawLength = std::min<std::size_t>(BLOCK_SIZE, fileData.size() - block * BLOCK_SIZE);
+                const std::byte* raw = fileData.data() + block * BLOCK_SIZE;
+
+                std::size_t destLen = codec.Compress(std::span<const std::byte>(raw, rawLength),
+                    std::span<std::byte>(out + cursor, outBuffer.size() - cursor), level);
+
+                // Blocks that do not shrink are stored; the reader tells them apart by size
+                if (destLen == 0 || destLen >= rawLength)
+                {
+                    std::memcpy(out + cursor, raw, rawLength);
+                    destLen = rawLength;
+                }
 
-    bool iequals(std::string_view a, std::string_view b)
+                cursor += destLen;
+
+                const std::uint32_t blockEnd = static_cast<std::uint32_t>(cursor - dataStart);
+                std::memcpy(out + 2 * sizeof(std::uint32_t) + block * sizeof(std::uint32_t), &blockEnd, sizeof(blockEnd));
+            }
+
+            if (cursor >= fileData.size())
+                return fileData;
+
+            entry.dwCompressedLength = static_cast<std::uint32_t>(cursor);
+            entry.dwFlags = AFPCK_ENTRY_BLOCKED | (codec.GetId() << AFPCK_ENTRY_CODEC_SHIFT);
+
+            return std::span<const std::byte>(outBuffer.data(), cursor);
+        }
+
+        if (outBuffer.size() < fileData.size())
+            outBuffer.resize(fileData.size());
+
+        const bool primed = dictionaryId != 0 && codec.GetId() == ACODEC_ZLIB;
+        const std::span<std::byte> dest(outBuffer.data(), fileData.size());
+        const std::size_t destLen = primed ? ACodec_ZlibCompress(fileData, dest, level, dictionary) : codec.Compress(fileData, dest, level);
+        if (destLen == 0 || destLen >= fileData.size())
+            return fileData;
+
+        entry.dwCompressedLength = static_cast<std::uint32_t>(destLen);
+        entry.dwFlags = (codec.GetId() << AFPCK_ENTRY_CODEC_SHIFT) | (primed ? dictionaryId << AFPCK_ENTRY_DICT_SHIFT : 0);
+
+        return std::span<const std::byte>(outBuffer.data(), destLen);
+    }
+
+    // Solid block payload: uint32 decoded length, then the concatenated files compressed as one
+    // stream, or stored when that does not shrink them; the reader tells the two apart by size
+    std::span<const std::byte> EncodeSolidBlock(std::span<const std::byte> blockData, const ACodec& codec, int level, std::vector<std::byte>& outBuffer)
+    {
+        const std::uint32_t decodedLength = static_cast<std::uint32_t>(blockData.size());
+        const std::size_t bound = sizeof(decodedLength) + std::max(blockData.size(), codec.GetCompressBound(blockData.size()));
+        if (outBuffer.size() < bound)
+            outBuffer.resize(bound);
+
+        std::memcpy(outBuffer.data(), &decodedLength, sizeof(decodedLength));
+        const std::span<std::byte> body(outBuffer.data() + sizeof(decodedLength), bound - sizeof(decodedLength));
+        std::size_t destLen = codec.Compress(blockData, body, level);
+        if (destLen == 0 || destLen >= blockData.size())
+        {
+            std::memcpy(body.data(), blockData.data(), blockData.size());
+            destLen = blockData.size();
+        }
+
+        return std::span<const std::byte>(outBuffer.data(), sizeof(decodedLength) + destLen);
+    }
+
+    std::string GetDictionaryName(std::uint32_t dictionaryId)
+    {
+        return std::string(AFPCK_DICTIONARY_FOLDER) + std::to_string(dictionaryId);
+    }
+
+    bool IsDictionaryName(std::string_view name)
+    {
+        return name.size() > AFPCK_DICTIONARY_FOLDER.size() &&
+            AFilePackage::FileNamesEqual(name.substr(0, AFPCK_DICTIONARY_FOLDER.size()), AFPCK_DICTIONARY_FOLDER);
+    }
+
+    const ACodec* GetEntryCodec(const AFPCK_ENTRYINFO& entry)
     {
-        return a.size() == b.size() &&
-            std::equal(a.begin(), a.end(), b.begin(),
-                [](char ca, char cb) {
-                    return std::tolower(static_cast<unsigned char>(ca)) ==
-                        std::tolower(static_cast<unsigned char>(cb));
-                });
+        const ACodec* codec = ACodec_Find((entry.dwFlags & AFPCK_ENTRY_CODEC_MASK) >> AFPCK_ENTRY_CODEC_SHIFT);
+        if (!codec)
+            AFERRLOG(L"AFilePackage::ReadFile(), Unknown codec {}", (entry.dwFlags & AFPCK_ENTRY_CODEC_MASK) >> AFPCK_ENTRY_CODEC_SHIFT);
+
+        return codec;
+    }
+
+    // Lower-case extension of a normalized entry name, without the dot
+    std::string GetExtension(std::string_view name)
+    {
+        const std::size_t dot = name.find_last_of(".\\");
+        if (dot == std::string_view::npos || name[dot] != '.')
+            return {};
+
+        std::string extension(name.substr(dot + 1));
+        std::transform(extension.begin(), extension.end(), extension.begin(),
+            [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+        return extension;
     }
 
     // Helper: case-insensitive string compare
@@ -44,34 +374,41 @@ namespace
     }
 }
 
+AFilePackage::AFilePackage()
+{
+    m_blockCache.SetBudget(SOLID_CACHE_BUDGET);
+}
+
 AFilePackage::~AFilePackage()
 {
     AFilePackage::Close();
 }
 
-bool AFilePackage::Open(std::wstring_view pckPath, AFPCK_OPENMODE mode)
+bool AFilePackage::Open(std::wstring_view pckPath, AFPCK_OPENMODE mode, std::uint32_t flags)
 {
     if (m_packageFile.is_open())
         Close();
 
     m_mode = mode;
+    m_packagePath = pckPath;
     m_hasChanged = false;
     m_readOnly = false;
 
     std::ios::openmode fmode;
     if (mode == AFPCK_OPENMODE::AFPCK_CREATENEW)
     {
-        fmode = std::ios::binary | std::ios::out | std::ios::trunc;
-        m_packageFile.open(pckPath, fmode);
+        // Readable too, so that dedup can verify candidates against payloads already written
+        fmode = std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc;
+        m_packageFile.open(std::filesystem::path(pckPath), fmode);
         if (!m_packageFile)
         {
             AFERRLOG(L"AFilePackage::Open(), Can not create file [{}]", pckPath);
             return false;
         }
 
-        // Initialize header
-        m_header = AFPCK_FILEHEADER{};
-        m_header.dwVersion = CURRENT_VERSION;
+        // Initialize header; the format is fixed for the life of the package
+        m_header = AFPCK_FILEHEADER64{};
+        m_header.dwVersion = (flags & AFPCK_CREATE_LARGE) != 0 ? LARGE_VERSION : CURRENT_VERSION;
 
         constexpr std::string_view desc = "Angelica File Package, Beijing E-Pie Entertainment Corporation 2002~2008. All Rights Reserved. ";
         const size_t maxDescLen = sizeof(m_header.szDescription) - 1;
@@ -80,17 +417,42 @@ bool AFilePackage::Open(std::wstring_view pckPath, AFPCK_OPENMODE mode)
         m_header.szDescription[copyDescLen] = '\0';
 
         m_fileEntries.clear();
+        m_namePool.clear();
+        m_deadNameBytes = 0;
+        RebuildIndex();
+        ResetJournal();
+
+        // Payloads follow the signature
+        const PACKAGESIGNATURE signature = MakeSignature(0);
+        m_packageFile.write(reinterpret_cast<const char*>(&signature), sizeof(signature));
+        if (!m_packageFile)
+        {
+            AFERRLOG(L"AFilePackage::Open(), Can not write file [{}]", pckPath);
+            m_packageFile.close();
+            return false;
+        }
+
+        m_packageId = signature.packageId;
+        m_appendOffset = SIGNATURE_SIZE;
+        RebuildFreeExtents();
         m_readOnly = false;
     }
     else
     {
-        // Try read-write first, then read-only
-        fmode = std::ios::binary | std::ios::in | std::ios::out;
-        m_packageFile.open(pckPath, fmode);
-        if (!m_packageFile)
+        // Try read-write first, then read-only. Mapped and concurrent packages are always read-only.
+        const bool mapped = (flags & AFPCK_OPEN_MAPPED) != 0;
+        const bool concurrent = (flags & AFPCK_OPEN_CONCURRENT) != 0;
+        if (!mapped && !concurrent)
+        {
+            fmode = std::ios::binary | std::ios::in | std::ios::out;
+            m_packageFile.open(std::filesystem::path(pckPath), fmode);
+        }
+
+        if (!m_packageFile.is_open())
         {
             fmode = std::ios::binary | std::ios::in;
-            m_packageFile.open(pckPath, fmode);
+            m_packageFile.clear();
+            m_packageFile.open(std::filesystem::path(pckPath), fmode);
             if (!m_packageFile)
             {
                 AFERRLOG(L"AFilePackage::Open(), Can not open file [{}]", pckPath);
@@ -102,24 +464,26 @@ bool AFilePackage::Open(std::wstring_view pckPath, AFPCK_OPENMODE mode)
         else
             m_readOnly = false;
 
-        // Read version from end
-        m_packageFile.seekg(-static_cast<std::streamoff>(sizeof(std::uint32_t)), std::ios::end);
-        std::uint32_t version = 0;
-        m_packageFile.read(reinterpret_cast<char*>(&version), sizeof(version));
-        if (version != CURRENT_VERSION)
+        // Opened before the directory is loaded so that it is parsed straight from the mapping
+        if (mapped && !m_mapping.Open(pckPath))
         {
-            AFERRLOG(L"AFilePackage::Open(), Incorrect version! Got {:#x}", version);
+            AFERRLOG(L"AFilePackage::Open(), Can not map file [{}]", pckPath);
             return false;
         }
 
-        if (!LoadEntries())
+        // A mapping is already safe for concurrent reads
+        if (concurrent && !mapped && !m_positionalFile.Open(pckPath))
+        {
+            AFERRLOG(L"AFilePackage::Open(), Can not open file [{}] for positional reads", pckPath);
             return false;
+        }
 
-        ResortEntries();
+        if (!LoadEntries())
+            return false;
     }
 
-    // Prepare compression buffer if needed
-    if (IsAFCompressionEnabled())
+    // Prepare compression buffer if needed; concurrent reads use their own scratch
+    if (IsAFCompressionEnabled() && !IsConcurrent())
         m_compressionBuffer.resize(1024 * 1024);
 
     return true;
@@ -127,6 +491,14 @@ bool AFilePackage::Open(std::wstring_view pckPath, AFPCK_OPENMODE mode)
 
 bool AFilePackage::Close()
 {
+    // Queued async reads see the cancellation and finish before the file goes away
+    m_closeToken.Cancel();
+    {
+        std::lock_guard<std::mutex> lock(m_asyncMutex);
+        m_asyncPool.reset();
+    }
+    m_closeToken = ACancelToken();
+
     if (!m_packageFile.is_open())
         return true;
 
@@ -136,14 +508,50 @@ bool AFilePackage::Close()
         SaveEntries();
 
     m_packageFile.close();
+
+    // Drop uncommitted payloads and anything a crash left behind the last footer
+    if (!m_readOnly && m_committedEnd > 0)
+    {
+        std::error_code error;
+        if (std::filesystem::file_size(m_packagePath, error) > m_committedEnd && !error)
+            std::filesystem::resize_file(m_packagePath, m_committedEnd, error);
+
+        if (error)
+            AFERRLOG(L"AFilePackage::Close(), Can not truncate [{}]", m_packagePath);
+    }
+    m_mapping.Close();
+    m_positionalFile.Close();
     m_fileEntries.clear();
+    m_namePool.clear();
+    m_deadNameBytes = 0;
+    m_index.clear();
+    m_freeExtents.clear();
+    m_freeBySize.clear();
+    m_pendingFree.clear();
+    m_freeBytes = 0;
+    m_payloadRefs.clear();
+    m_payloadRefsBuilt = false;
+    m_dedupPayloads.clear();
+    m_dedupStats = {};
+    m_accessTrace.Stop();
+    ResetJournal();
+    m_packageId = 0;
+    m_entryCache.Clear();
+    m_blockCache.Clear();
+    m_extensionDictionaries.clear();
+    m_categoryStats.clear();
+    {
+        std::lock_guard<std::mutex> lock(m_dictionaryMutex);
+        m_dictionaries.fill(nullptr);
+    }
     m_compressionBuffer.clear();
+    m_dedupBuffer.clear();
     m_hasChanged = false;
 
     return true;
 }
 
-bool AFilePackage::AppendFile(std::wstring_view fileName, std::span<const std::byte> fileData)
+bool AFilePackage::AppendFile(std::wstring_view fileName, std::span<const std::byte> fileData, std::uint32_t codecId)
 {
     if (m_readOnly)
     {
@@ -151,52 +559,379 @@ bool AFilePackage::AppendFile(std::wstring_view fileName, std::span<const std::b
         return false;
     }
 
-    AFPCK_FILEENTRY newEntry{};
-    std::string normalized = NormalizeFileName(fileName);
-    const size_t maxNameLen = sizeof(newEntry.szFileName) - 1;
-    const size_t copyNameLen = std::min(normalized.size(), maxNameLen);
-    std::copy(normalized.begin(), normalized.begin() + copyNameLen, newEntry.szFileName);
-    newEntry.szFileName[copyNameLen] = '\0';
+    // The journal records entries by name, so names must stay unique and fit the directory whole
+    const std::string normalized = NormalizeFileName(fileName);
+    if (normalized.size() > MAX_NAME_LENGTH)
+    {
+        AFERRLOG(L"AFilePackage::AppendFile(), File name too long: {}", fileName);
+        return false;
+    }
+
+    if (FindEntryIndex(normalized) >= 0)
+    {
+        AFERRLOG(L"AFilePackage::AppendFile(), File already exists: {}", fileName);
+        return false;
+    }
+
+    AFPCK_ENTRYINFO newEntry{};
+    const bool dedup = m_dedup && !fileData.empty();
+    const AHASH128 contentHash = dedup ? AHash128(fileData) : AHASH128{};
+    if (dedup && FindDuplicate(contentHash, fileData, newEntry))
+    {
+        AddSharedEntry(normalized, newEntry);
+        return true;
+    }
+
+    const ACodec* codec = SelectCodec(normalized, codecId);
+    AFPCK_CATEGORYSTATS categoryStats{};
+    const std::span<const std::byte> payload = EncodePayload(normalized, fileData, codec, SelectDictionary(normalized, codec), newEntry, categoryStats);
+    if (!WriteNewEntry(normalized, newEntry, payload))
+        return false;
+
+    AddCategoryStats(normalized, categoryStats);
+    if (dedup)
+        m_dedupPayloads.emplace(contentHash, newEntry);
+
+    return true;
+}
+
+bool AFilePackage::AppendFiles(std::span<const AFPCK_APPENDITEM> items, int compressionLevel, unsigned int workerCount, AFPCK_BATCHSTATS* outStats)
+{
+    if (m_readOnly)
+    {
+        AFERRLOG(L"AFilePackage::AppendFiles(), Read-only package");
+        return false;
+    }
 
-    std::uint32_t compressedLen = static_cast<std::uint32_t>(fileData.size());
-    if (IsAFCompressionEnabled())
+    struct ENCODEDITEM
     {
-        if (m_compressionBuffer.size() < fileData.size())
-            m_compressionBuffer.resize(fileData.size());
+        std::string name;
+        AFPCK_ENTRYINFO entry{};
+        std::vector<std::byte> buffer;
+        std::span<const std::byte> payload;
+        AHASH128 contentHash{};
+        double seconds = 0.0;
+        double policySeconds = 0.0;
+        double encodeSeconds = 0.0;
+        bool solid = false;   // Packed into a solid block instead of encoded on its own
+        bool skipped = false; // Stored as the compression policy decided
+    };
+
+    // Nothing is written unless every name fits and is new to the package and to the batch
+    std::vector<std::string> names(items.size());
+    std::unordered_multimap<std::uint64_t, std::size_t> batchNames;
+    for (std::size_t i = 0; i < items.size(); ++i)
+    {
+        names[i] = NormalizeFileName(items[i].fileName);
+        if (names[i].size() > MAX_NAME_LENGTH)
+        {
+            AFERRLOG(L"AFilePackage::AppendFiles(), File name too long: {}", items[i].fileName);
+            return false;
+        }
 
-        uLongf destLen = static_cast<uLongf>(m_compressionBuffer.size());
-        int result = compress2(
-            reinterpret_cast<Bytef*>(m_compressionBuffer.data()),
-            &destLen,
-            reinterpret_cast<const Bytef*>(fileData.data()),
-            static_cast<uLong>(fileData.size()),
-            Z_BEST_SPEED
-        );
+        const std::uint64_t hash = HashFileName(names[i]);
+        auto [it, last] = batchNames.equal_range(hash);
+        const bool repeated = std::any_of(it, last, [&](const auto& other) { return FileNamesEqual(names[other.second], names[i]); });
+        if (repeated || FindEntryIndex(names[i]) >= 0)
+        {
+            AFERRLOG(L"AFilePackage::AppendFiles(), File already exists: {}", items[i].fileName);
+            return false;
+        }
 
-        if (result == Z_OK && destLen < fileData.size())
-            compressedLen = static_cast<std::uint32_t>(destLen);
+        batchNames.emplace(hash, i);
     }
 
-    newEntry.dwOffset = m_header.dwEntryOffset;
-    newEntry.dwLength = static_cast<std::uint32_t>(fileData.size());
-    newEntry.dwCompressedLength = compressedLen;
+    const auto startTime = std::chrono::steady_clock::now();
+    const bool compress = IsAFCompressionEnabled();
+    const bool dedup = m_dedup;
+    const ACodec* solidCodec = compress && m_solidMaxLength > 0 ? ACodec_Find(m_defaultCodec) : nullptr;
+    const ACompressionPolicy* policy = m_compressionPolicy;
+    AThreadPool pool(workerCount);
+
+    // Keep a bounded window of items in flight; results are written strictly in input order
+    const std::size_t window = static_cast<std::size_t>(pool.GetThreadCount()) * 2;
+    std::deque<std::future<std::unique_ptr<ENCODEDITEM>>> inFlight;
+    std::size_t nextSubmit = 0;
+
+    auto submitNext = [&]() {
+        const AFPCK_APPENDITEM& item = items[nextSubmit];
+        auto encoded = std::make_unique<ENCODEDITEM>();
+        encoded->name = std::move(names[nextSubmit++]);
+        const ACodec* codec = compress ? SelectCodec(encoded->name, item.codecId) : nullptr;
+        encoded->solid = solidCodec && codec == solidCodec && !item.fileData.empty() && item.fileData.size() <= m_solidMaxLength;
+
+        // Looked up here, since dictionaries load through the package; the shared buffer keeps it alive for the task
+        const std::uint32_t dictionaryId = encoded->solid ? 0 : SelectDictionary(encoded->name, codec);
+        AEntryBuffer dictionary = dictionaryId != 0 ? GetDictionary(dictionaryId) : nullptr;
+
+        inFlight.push_back(pool.Submit([&item, codec, policy, compressionLevel, dedup, dictionaryId, dictionary = std::move(dictionary), encoded = std::move(encoded)]() mutable {
+            const auto begin = std::chrono::steady_clock::now();
+            if (dedup)
+                encoded->contentHash = AHash128(item.fileData);
+
+            // A file the policy stores is written on its own, even when small enough for a solid block
+            int level = compressionLevel;
+            if (codec && policy)
+            {
+                const auto policyBegin = std::chrono::steady_clock::now();
+                const ACOMPRESSIONDECISION decision = policy->Decide(encoded->name, item.fileData, *codec, compressionLevel);
+                encoded->policySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - policyBegin).count();
+                encoded->skipped = !decision.compress;
+                encoded->solid = encoded->solid && decision.compress;
+                level = decision.level;
+            }
+
+            if (codec && !encoded->skipped && !encoded->solid)
+            {
+                const auto encodeBegin = std::chrono::steady_clock::now();
+                encoded->payload = ::EncodePayload(item.fileData, *codec, level, encoded->buffer, encoded->entry,
+                    dictionary ? dictionaryId : 0, dictionary ? std::span<const std::byte>(*dictionary) : std::span<const std::byte>());
+                encoded->encodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - encodeBegin).count();
+            }
+            else
+            {
+                encoded->entry.dwLength = static_cast<std::uint32_t>(item.fileData.size());
+                encoded->entry.dwCompressedLength = encoded->entry.dwLength;
+                encoded->payload = item.fileData;
+            }
 
-    // Write data
-    m_packageFile.seekp(m_header.dwEntryOffset);
-    if (compressedLen < newEntry.dwLength)
-        m_packageFile.write(reinterpret_cast<const char*>(m_compressionBuffer.data()), compressedLen);
-    else
-        m_packageFile.write(reinterpret_cast<const char*>(fileData.data()), fileData.size());
+            encoded->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            return std::move(encoded);
+        }));
+    };
+
+    AFPCK_BATCHSTATS stats{};
+    bool result = true;
+
+    // Small files collect in the open solid block until the next one would overflow it
+    std::vector<SOLIDMEMBER> solidMembers;
+    std::vector<std::byte> solidData;
+    std::vector<std::byte> solidScratch;
+    std::unordered_multimap<AHASH128, std::size_t, AHASH128_HASHER> solidHashes; // Content hash -> index in solidMembers
+    auto flushSolid = [&]() {
+        std::uint64_t storedBytes = 0;
+        const auto begin = std::chrono::steady_clock::now();
+        const bool written = solidMembers.empty() ||
+            WriteSolidBlock(solidMembers, solidData, *solidCodec, compressionLevel, solidScratch, storedBytes);
+        if (!written)
+            AFERRLOG(L"AFilePackage::AppendFiles(), Failed to append a solid block of {} files", solidMembers.size());
+        else if (!solidMembers.empty())
+        {
+            stats.fileCount += solidMembers.size();
+            stats.solidFiles += solidMembers.size();
+            stats.storedBytes += storedBytes;
+            ++stats.solidBlocks;
+
+            // The block's size and time are shared out among its members by raw size
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            for (const SOLIDMEMBER& member : solidMembers)
+            {
+                const double share = static_cast<double>(member.length) / static_cast<double>(solidData.size());
+                stats.rawBytes += member.length;
+                stats.compressSeconds += member.seconds;
+                if (member.duplicate)
+                {
+                    ++stats.dedupedFiles;
+                    ++m_dedupStats.dedupedFiles;
+                    m_dedupStats.savedBytes += static_cast<std::uint64_t>(static_cast<double>(storedBytes) * share + 0.5);
+                    continue;
+                }
+
+                AFPCK_CATEGORYSTATS delta{};
+                delta.fileCount = 1;
+                delta.rawBytes = member.length;
+                delta.storedBytes = static_cast<std::uint64_t>(static_cast<double>(storedBytes) * share + 0.5);
+                delta.policySeconds = member.policySeconds;
+                delta.compressSeconds = seconds * share;
+                AddCategoryStats(member.name, delta);
+            }
+        }
+
+        solidMembers.clear();
+        solidData.clear();
+        solidHashes.clear();
+        return written;
+    };
+
+    for (std::size_t i = 0; i < items.size(); ++i)
+    {
+        while (nextSubmit < items.size() && inFlight.size() < window)
+            submitNext();
+
+        std::unique_ptr<ENCODEDITEM> encoded = inFlight.front().get();
+        inFlight.pop_front();
+
+        // Duplicates are found in input order, so they may match earlier items of the same batch
+        const bool itemDedup = dedup && !items[i].fileData.empty();
+        AFPCK_ENTRYINFO sharedEntry{};
+        const bool shared = result && itemDedup && FindDuplicate(encoded->contentHash, items[i].fileData, sharedEntry);
+
+        // Files of the open solid block are not written yet, so FindDuplicate() can not see them
+        const SOLIDMEMBER* twin = nullptr;
+        if (result && itemDedup && !shared)
+        {
+            auto [it, last] = solidHashes.equal_range(encoded->contentHash);
+            for (; it != last && !twin; ++it)
+            {
+                const SOLIDMEMBER& member = solidMembers[it->second];
+                if (member.length == items[i].fileData.size() &&
+                    std::memcmp(solidData.data() + member.offset, items[i].fileData.data(), member.length) == 0)
+                    twin = &member;
+            }
+        }
+
+        const bool packed = result && !shared && (encoded->solid || twin);
+        if (shared)
+            AddSharedEntry(encoded->name, sharedEntry);
+        else if (twin)
+        {
+            const std::uint32_t offset = twin->offset;
+            solidMembers.push_back({ std::move(encoded->name), offset, encoded->entry.dwLength, encoded->contentHash,
+                encoded->seconds, encoded->policySeconds, true });
+        }
+        else if (packed)
+        {
+            if (solidData.size() + items[i].fileData.size() > SOLID_BLOCK_SIZE)
+                result = flushSolid();
+
+            const auto offset = static_cast<std::uint32_t>(solidData.size());
+            if (itemDedup)
+                solidHashes.emplace(encoded->contentHash, solidMembers.size());
+
+            solidMembers.push_back({ std::move(encoded->name), offset, encoded->entry.dwLength, encoded->contentHash,
+                encoded->seconds, encoded->policySeconds, false });
+            solidData.insert(solidData.end(), items[i].fileData.begin(), items[i].fileData.end());
+        }
+        else if (result && !WriteNewEntry(encoded->name, encoded->entry, encoded->payload))
+        {
+            AFERRLOG(L"AFilePackage::AppendFiles(), Failed to append [{}]", items[i].fileName);
+            result = false;
+        }
+        else if (result && itemDedup)
+            m_dedupPayloads.emplace(encoded->contentHash, encoded->entry);
+
+        // Only files that made it into the package are counted; packed ones when their block is written
+        if (!result || packed)
+            continue;
+
+        if (!shared)
+        {
+            AFPCK_CATEGORYSTATS delta{};
+            delta.fileCount = 1;
+            delta.skippedFiles = encoded->skipped ? 1 : 0;
+            delta.rawBytes = encoded->entry.dwLength;
+            delta.storedBytes = encoded->entry.dwCompressedLength;
+            delta.skippedBytes = encoded->skipped ? encoded->entry.dwLength : 0;
+            delta.policySeconds = encoded->policySeconds;
+            delta.compressSeconds = encoded->encodeSeconds;
+            AddCategoryStats(encoded->name, delta);
+        }
+
+        ++stats.fileCount;
+        stats.dedupedFiles += shared ? 1 : 0;
+        stats.rawBytes += encoded->entry.dwLength;
+        stats.storedBytes += shared ? 0 : encoded->entry.dwCompressedLength;
+        stats.compressSeconds += encoded->seconds;
+    }
+
+    if (result && !flushSolid())
+        result = false;
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    stats.rawMBPerSecond = stats.seconds > 0.0 ? static_cast<double>(stats.rawBytes) / (1024.0 * 1024.0) / stats.seconds : 0.0;
+    stats.workerCount = pool.GetThreadCount();
+
+    if (outStats)
+        *outStats = stats;
+
+    return result;
+}
 
-    m_header.dwEntryOffset += compressedLen;
+bool AFilePackage::WriteNewEntry(std::string_view fileName, AFPCK_ENTRYINFO& entry, std::span<const std::byte> payload)
+{
+    if (!WritePayload(payload, entry))
+        return false;
 
-    m_fileEntries.push_back(newEntry);
+    AddEntry(fileName, entry);
+    AddPayloadRef(entry);
+    m_dirtyNames.emplace(fileName);
     m_hasChanged = true;
-    m_hasSorted = false;
 
     return true;
 }
 
+bool AFilePackage::WriteSolidBlock(std::span<const SOLIDMEMBER> members, std::span<const std::byte> blockData, const ACodec& codec,
+    int level, std::vector<std::byte>& scratch, std::uint64_t& outStoredBytes)
+{
+    const std::span<const std::byte> payload = EncodeSolidBlock(blockData, codec, level, scratch);
+    AFPCK_ENTRYINFO blockEntry{};
+    if (!WritePayload(payload, blockEntry))
+        return false;
+
+    // Every member references the whole block, so it is freed with the last of them
+    for (const SOLIDMEMBER& member : members)
+    {
+        AFPCK_ENTRYINFO entry{};
+        entry.dwOffset = blockEntry.dwOffset;
+        entry.dwLength = member.length;
+        entry.dwCompressedLength = static_cast<std::uint32_t>(payload.size());
+        entry.dwFlags = AFPCK_ENTRY_SOLID | (codec.GetId() << AFPCK_ENTRY_CODEC_SHIFT) | (member.offset << AFPCK_ENTRY_SOLID_OFFSET_SHIFT);
+
+        AddEntry(member.name, entry);
+        AddPayloadRef(entry);
+        m_dirtyNames.emplace(member.name);
+
+        if (m_dedup && !member.duplicate)
+            m_dedupPayloads.emplace(member.contentHash, entry);
+    }
+
+    m_hasChanged = true;
+    outStoredBytes = payload.size();
+
+    return true;
+}
+
+void AFilePackage::AddSharedEntry(std::string_view fileName, const AFPCK_ENTRYINFO& payloadEntry)
+{
+    AddEntry(fileName, payloadEntry);
+    AddPayloadRef(payloadEntry);
+    m_dirtyNames.emplace(fileName);
+    m_hasChanged = true;
+
+    ++m_dedupStats.dedupedFiles;
+    m_dedupStats.savedBytes += payloadEntry.dwCompressedLength;
+}
+
+void AFilePackage::AddEntry(std::string_view name, AFPCK_ENTRYINFO entry)
+{
+    entry.dwNameOffset = AddEntryName(name);
+    entry.dwNameLength = static_cast<std::uint32_t>(name.size());
+
+    m_fileEntries.push_back(entry);
+    IndexInsert(HashFileName(name), static_cast<std::uint32_t>(m_fileEntries.size() - 1));
+    m_hasSorted = false;
+}
+
+void AFilePackage::EraseEntry(int index)
+{
+    // Swap with the last entry so only one index slot has to move
+    const auto last = static_cast<std::uint32_t>(m_fileEntries.size() - 1);
+    IndexErase(HashFileName(GetEntryName(m_fileEntries[index])), static_cast<std::uint32_t>(index));
+    m_deadNameBytes += m_fileEntries[index].dwNameLength + 1;
+    if (static_cast<std::uint32_t>(index) != last)
+    {
+        m_fileEntries[index] = m_fileEntries[last];
+        IndexRelocate(HashFileName(GetEntryName(m_fileEntries[index])), last, static_cast<std::uint32_t>(index));
+    }
+
+    m_fileEntries.pop_back();
+
+    if (m_deadNameBytes > m_namePool.size() / 2)
+        CompactNamePool();
+
+    m_hasSorted = false;
+}
+
 bool AFilePackage::RemoveFile(std::wstring_view fileName)
 {
     if (m_readOnly)
@@ -205,17 +940,26 @@ bool AFilePackage::RemoveFile(std::wstring_view fileName)
         return false;
     }
 
-    int index = -1;
-    AFPCK_FILEENTRY entry;
-    if (!GetFileEntry(fileName, entry, &index))
+    int index = FindEntryIndex(fileName);
+    if (index < 0)
     {
         AFERRLOG(L"AFilePackage::RemoveFile(), File not found: {}", fileName);
         return false;
     }
 
-    m_fileEntries.erase(m_fileEntries.begin() + index);
+    // Entries compressed with a dictionary would become unreadable
+    if (IsDictionaryName(GetEntryName(m_fileEntries[index])))
+    {
+        AFERRLOG(L"AFilePackage::RemoveFile(), Preset dictionaries can not be removed: {}", fileName);
+        return false;
+    }
+
+    const AFPCK_ENTRYINFO& entry = m_fileEntries[index];
+    ReleasePayload(entry);
+    m_dirtyNames.emplace(GetEntryName(entry));
+    EraseEntry(index);
+
     m_hasChanged = true;
-    m_hasSorted = false;
 
     return true;
 }
@@ -223,7 +967,7 @@ bool AFilePackage::RemoveFile(std::wstring_view fileName)
 #ifdef ReplaceFile
 #pragma push_macro("ReplaceFile")
 #undef ReplaceFile
-bool AFilePackage::ReplaceFile(std::wstring_view fileName, std::span<const std::byte> fileData)
+bool AFilePackage::ReplaceFile(std::wstring_view fileName, std::span<const std::byte> fileData, std::uint32_t codecId)
 #endif
 {
     if (m_readOnly)
@@ -232,47 +976,63 @@ bool AFilePackage::ReplaceFile(std::wstring_view fileName, std::span<const std::
         return false;
     }
 
-    int index = -1;
-    AFPCK_FILEENTRY entry;
-    if (!GetFileEntry(fileName, entry, &index))
+    const std::string normalized = NormalizeFileName(fileName);
+    int index = FindEntryIndex(normalized);
+    if (index < 0)
     {
         AFERRLOG(L"AFilePackage::ReplaceFile(), File not found: {}", fileName);
         return false;
     }
 
-    std::uint32_t compressedLen = static_cast<std::uint32_t>(fileData.size());
-    if (IsAFCompressionEnabled())
+    if (IsDictionaryName(GetEntryName(m_fileEntries[index])))
     {
-        if (m_compressionBuffer.size() < fileData.size())
-            m_compressionBuffer.resize(fileData.size());
+        AFERRLOG(L"AFilePackage::ReplaceFile(), Preset dictionaries can not be replaced: {}", fileName);
+        return false;
+    }
 
-        uLongf destLen = static_cast<uLongf>(m_compressionBuffer.size());
-        int result = compress2(
-            reinterpret_cast<Bytef*>(m_compressionBuffer.data()),
-            &destLen,
-            reinterpret_cast<const Bytef*>(fileData.data()),
-            static_cast<uLong>(fileData.size()),
-            Z_BEST_SPEED
-        );
+    AFPCK_ENTRYINFO& entry = m_fileEntries[index];
+    const bool dedup = m_dedup && !fileData.empty();
+    const AHASH128 contentHash = dedup ? AHash128(fileData) : AHASH128{};
+    AFPCK_ENTRYINFO sharedEntry{};
+    if (dedup && FindDuplicate(contentHash, fileData, sharedEntry))
+    {
+        // Referenced before the old payload is released, in case they are the same
+        AddPayloadRef(sharedEntry);
+        ReleasePayload(entry);
+        entry.dwOffset = sharedEntry.dwOffset;
+        entry.dwLength = sharedEntry.dwLength;
+        entry.dwCompressedLength = sharedEntry.dwCompressedLength;
+        entry.dwFlags = sharedEntry.dwFlags;
+
+        ++m_dedupStats.dedupedFiles;
+        m_dedupStats.savedBytes += sharedEntry.dwCompressedLength;
+        m_dirtyNames.emplace(GetEntryName(entry));
+        m_hasChanged = true;
+        m_hasSorted = false;
 
-        if (result == Z_OK && destLen < fileData.size())
-            compressedLen = static_cast<std::uint32_t>(destLen);
+        return true;
     }
 
-    // Update entry
-    m_fileEntries[index].dwOffset = m_header.dwEntryOffset;
-    m_fileEntries[index].dwLength = static_cast<std::uint32_t>(fileData.size());
-    m_fileEntries[index].dwCompressedLength = compressedLen;
+    // Encoded and written aside; the entry and its old payload are untouched unless the write succeeds
+    AFPCK_ENTRYINFO newEntry{};
+    AFPCK_CATEGORYSTATS categoryStats{};
+    const ACodec* codec = SelectCodec(normalized, codecId);
+    const std::span<const std::byte> payload = EncodePayload(normalized, fileData, codec, SelectDictionary(normalized, codec), newEntry, categoryStats);
+    if (!WritePayload(payload, newEntry))
+        return false;
 
-    // Write new data
-    m_packageFile.seekp(m_header.dwEntryOffset);
-    if (compressedLen < m_fileEntries[index].dwLength)
-        m_packageFile.write(reinterpret_cast<const char*>(m_compressionBuffer.data()), compressedLen);
-    else
-        m_packageFile.write(reinterpret_cast<const char*>(fileData.data()), fileData.size());
+    ReleasePayload(entry);
+    entry.dwOffset = newEntry.dwOffset;
+    entry.dwLength = newEntry.dwLength;
+    entry.dwCompressedLength = newEntry.dwCompressedLength;
+    entry.dwFlags = newEntry.dwFlags;
 
-    m_header.dwEntryOffset += compressedLen;
+    AddPayloadRef(entry);
+    AddCategoryStats(normalized, categoryStats);
+    if (dedup)
+        m_dedupPayloads.emplace(contentHash, entry);
 
+    m_dirtyNames.emplace(GetEntryName(entry));
     m_hasChanged = true;
     m_hasSorted = false;
 
@@ -281,32 +1041,40 @@ bool AFilePackage::ReplaceFile(std::wstring_view fileName, std::span<const std::
 
 bool AFilePackage::ReadFile(std::wstring_view fileName, std::span<std::byte> buffer, std::size_t offset, std::size_t& bytesRead)
 {
-    AFPCK_FILEENTRY entry;
-    if (!GetFileEntry(fileName, entry))
+    const AFPCK_ENTRYINFO* entry = FindFile(fileName);
+    if (!entry)
     {
         AFERRLOG(L"AFilePackage::ReadFile(), Can not find file entry [{}]", fileName);
         return false;
     }
 
-    return ReadFile(entry, buffer, offset, bytesRead);
+    return ReadFile(*entry, buffer, offset, bytesRead);
 }
 
 bool AFilePackage::ReadFile(const AFPCK_FILEENTRY& entry, std::span<std::byte> buffer, std::size_t offset, std::size_t& bytesRead)
 {
+    AFPCK_ENTRYINFO info{ entry.dwOffset, entry.dwLength, entry.dwCompressedLength, entry.dwFlags, 0, 0 };
+    return ReadFile(info, buffer, offset, bytesRead);
+}
+
+bool AFilePackage::ReadFile(const AFPCK_ENTRYINFO& entry, std::span<std::byte> buffer, std::size_t offset, std::size_t& bytesRead)
+{
+    TraceAccess(entry);
+
+    bytesRead = 0;
     if (offset > entry.dwLength)
     {
         AFERRLOG(L"AFilePackage::ReadFile(), Offset [{}] beyond file length [{}]", offset, entry.dwLength);
         return false;
     }
 
-    std::size_t bytesToRead = entry.dwLength - offset;
-    if (buffer.size() < bytesToRead)
-    {
-        AFERRLOG(L"AFilePackage::ReadFile(), Buffer too small: {} < {}", buffer.size(), bytesToRead);
-        return false;
-    }
+    // Uncompressed, block-compressed and solid entries support partial reads into smaller buffers
+    const std::size_t bytesToRead = std::min<std::size_t>(buffer.size(), entry.dwLength - offset);
+    if (entry.dwFlags & AFPCK_ENTRY_BLOCKED)
+        return ReadBlockedFile(entry, buffer.first(bytesToRead), offset, bytesRead);
 
-    m_packageFile.seekg(entry.dwOffset + offset);
+    if (entry.dwFlags & AFPCK_ENTRY_SOLID)
+        return ReadSolidFile(entry, buffer.first(bytesToRead), offset, bytesRead);
 
     if (entry.dwCompressedLength < entry.dwLength)
     {
@@ -316,200 +1084,2582 @@ bool AFilePackage::ReadFile(const AFPCK_FILEENTRY& entry, std::span<std::byte> b
             return false;
         }
 
-        m_compressionBuffer.resize(entry.dwCompressedLength);
-        m_packageFile.read(reinterpret_cast<char*>(m_compressionBuffer.data()), entry.dwCompressedLength);
-        if (m_packageFile.gcount() != static_cast<std::streamsize>(entry.dwCompressedLength))
+        if (buffer.size() < entry.dwLength)
+        {
+            AFERRLOG(L"AFilePackage::ReadFile(), Buffer too small: {} < {}", buffer.size(), entry.dwLength);
+            return false;
+        }
+
+        const ACodec* codec = GetEntryCodec(entry);
+        if (!codec)
+            return false;
+
+        // Entries primed with a preset dictionary can not be decoded without it
+        const std::uint32_t dictionaryId = (entry.dwFlags & AFPCK_ENTRY_DICT_MASK) >> AFPCK_ENTRY_DICT_SHIFT;
+        const AEntryBuffer dictionary = dictionaryId != 0 ? GetDictionary(dictionaryId) : nullptr;
+        if (dictionaryId != 0 && !dictionary)
             return false;
 
-        uLongf destLen = static_cast<uLongf>(bytesToRead);
-        int result = uncompress(
-            reinterpret_cast<Bytef*>(buffer.data()),
-            &destLen,
-            reinterpret_cast<const Bytef*>(m_compressionBuffer.data()),
-            entry.dwCompressedLength
-        );
+        std::span<const std::byte> compressed;
+        if (!FetchRaw(entry.dwOffset, entry.dwCompressedLength, t_compressedScratch, compressed))
+            return false;
 
-        if (result != Z_OK)
+        const bool decoded = dictionary ? codec->GetId() == ACODEC_ZLIB && ACodec_ZlibDecompress(compressed, buffer.first(entry.dwLength), *dictionary)
+            : codec->Decompress(compressed, buffer.first(entry.dwLength));
+        if (!decoded)
         {
-            AFERRLOG(L"AFilePackage::ReadFile(), Decompression failed: {}", result);
+            AFERRLOG(L"AFilePackage::ReadFile(), Decompression failed");
             return false;
         }
 
-        bytesRead = static_cast<std::size_t>(destLen);
+        bytesRead = entry.dwLength;
     }
     else
     {
-        m_packageFile.read(reinterpret_cast<char*>(buffer.data()), bytesToRead);
-        bytesRead = static_cast<std::size_t>(m_packageFile.gcount());
+        if (!ReadRaw(static_cast<std::uint64_t>(entry.dwOffset) + offset, buffer.first(bytesToRead)))
+            return false;
+
+        bytesRead = bytesToRead;
     }
 
     return true;
 }
 
-bool AFilePackage::GetFileEntry(std::wstring_view fileName, AFPCK_FILEENTRY& outEntry, int* outIndex) const
+bool AFilePackage::StreamFile(std::wstring_view fileName, const AFPCK_STREAMSINK& sink, std::size_t chunkSize)
 {
-    auto normalized = NormalizeFileName(fileName);
-    if (!m_hasSorted)
+    const AFPCK_ENTRYINFO* entry = FindFile(fileName);
+    if (!entry)
     {
-        for (size_t i = 0; i < m_fileEntries.size(); ++i)
+        AFERRLOG(L"AFilePackage::StreamFile(), Can not find file entry [{}]", fileName);
+        return false;
+    }
+
+    return StreamFile(*entry, sink, chunkSize);
+}
+
+bool AFilePackage::StreamFile(const AFPCK_ENTRYINFO& entry, const AFPCK_STREAMSINK& sink, std::size_t chunkSize)
+{
+    TraceAccess(entry);
+
+    // Whole blocks per chunk let block-compressed entries inflate straight into it
+    chunkSize = std::max(BLOCK_SIZE, chunkSize - chunkSize % BLOCK_SIZE);
+    std::vector<std::byte> chunk(std::min<std::size_t>(chunkSize, entry.dwLength));
+
+    if (!(entry.dwFlags & (AFPCK_ENTRY_BLOCKED | AFPCK_ENTRY_SOLID)) && entry.dwCompressedLength < entry.dwLength)
+    {
+        const ACodec* codec = GetEntryCodec(entry);
+        if (!codec)
+            return false;
+
+        if (codec->GetId() == ACODEC_ZLIB)
+            return InflateStream(entry, chunk, sink);
+
+        // Other codecs only compress entries below BLOCKED_MIN_LENGTH as one stream, so decoding at once stays small
+        chunk.resize(entry.dwLength);
+        std::size_t bytesRead = 0;
+        return ReadFile(entry, chunk, 0, bytesRead) && sink(chunk);
+    }
+
+    // Stored, block-compressed and solid entries are read chunk by chunk at increasing offsets
+    for (std::size_t offset = 0; offset < entry.dwLength;)
+    {
+        std::size_t bytesRead = 0;
+        if (!ReadFile(entry, chunk, offset, bytesRead) || bytesRead == 0)
+            return false;
+
+        if (!sink(std::span<const std::byte>(chunk.data(), bytesRead)))
+            return false;
+
+        offset += bytesRead;
+    }
+
+    return true;
+}
+
+bool AFilePackage::InflateStream(const AFPCK_ENTRYINFO& entry, std::span<std::byte> chunk, const AFPCK_STREAMSINK& sink)
+{
+    const std::uint32_t dictionaryId = (entry.dwFlags & AFPCK_ENTRY_DICT_MASK) >> AFPCK_ENTRY_DICT_SHIFT;
+    const AEntryBuffer dictionary = dictionaryId != 0 ? GetDictionary(dictionaryId) : nullptr;
+    if (dictionaryId != 0 && !dictionary)
+        return false;
+
+    z_stream stream{};
+    if (inflateInit(&stream) != Z_OK)
+    {
+        AFERRLOG(L"AFilePackage::StreamFile(), inflateInit failed");
+        return false;
+    }
+
+    // Compressed input is fetched in chunk-sized pieces as inflate drains it
+    std::vector<std::byte> inputScratch;
+    std::uint64_t consumed = 0;
+    std::uint64_t produced = 0;
+    int result = Z_OK;
+    bool stopped = false;
+    while (result == Z_OK)
+    {
+        if (stream.avail_in == 0)
         {
-            if (iequals(normalized, m_fileEntries[i].szFileName))
-            {
-                outEntry = m_fileEntries[i];
-                if (outIndex)
-                    *outIndex = static_cast<int>(i);
+            const std::size_t length = static_cast<std::size_t>(std::min<std::uint64_t>(chunk.size(), entry.dwCompressedLength - consumed));
+            std::span<const std::byte> input;
+            if (length == 0 || !FetchRaw(entry.dwOffset + consumed, length, inputScratch, input))
+                break;
+
+            stream.next_in = reinterpret_cast<Bytef*>(const_cast<std::byte*>(input.data()));
+            stream.avail_in = static_cast<uInt>(length);
+            consumed += length;
+        }
 
-                return true;
-            }
+        stream.next_out = reinterpret_cast<Bytef*>(chunk.data());
+        stream.avail_out = static_cast<uInt>(chunk.size());
+        result = inflate(&stream, Z_NO_FLUSH);
+
+        // Asked for right after the stream header, before any output
+        if (result == Z_NEED_DICT && dictionary)
+            result = inflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(dictionary->data()), static_cast<uInt>(dictionary->size()));
+
+        const std::size_t outBytes = chunk.size() - stream.avail_out;
+        produced += outBytes;
+        if ((result != Z_OK && result != Z_STREAM_END) || produced > entry.dwLength)
+            break;
+
+        if (outBytes > 0 && !sink(chunk.first(outBytes)))
+        {
+            stopped = true;
+            break;
         }
     }
-    else
+
+    inflateEnd(&stream);
+    if (stopped)
+        return false;
+
+    if (result != Z_STREAM_END || produced != entry.dwLength)
+    {
+        AFERRLOG(L"AFilePackage::StreamFile(), Decompression failed");
+        return false;
+    }
+
+    return true;
+}
+
+bool AFilePackage::ReadFiles(std::span<AFPCK_READREQUEST> requests, std::size_t maxGap)
+{
+    std::vector<std::size_t> order;
+    order.reserve(requests.size());
+    for (std::size_t i = 0; i < requests.size(); ++i)
     {
-        // Binary search
-        auto it = std::lower_bound(m_fileEntries.begin(), m_fileEntries.end(), normalized,
-            [](const AFPCK_FILEENTRY& a, const std::string& b) {
-                return iequals(a.szFileName, b) ? false : std::strcmp(a.szFileName, b.c_str()) < 0;
-            });
+        requests[i].bytesRead = 0;
+        requests[i].succeeded = false;
+        if (requests[i].entry)
+            order.push_back(i);
+    }
+
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return requests[a].entry->dwOffset < requests[b].entry->dwOffset;
+    });
 
-        if (it != m_fileEntries.end() && iequals(it->szFileName, normalized))
+    bool result = order.size() == requests.size();
+    std::size_t runBegin = 0;
+    while (runBegin < order.size())
+    {
+        // Grow the run while the next entry starts within maxGap of its end
+        const std::uint64_t runStart = requests[order[runBegin]].entry->dwOffset;
+        std::uint64_t runEnd = runStart + requests[order[runBegin]].entry->dwCompressedLength;
+        std::size_t runLast = runBegin + 1;
+        while (runLast < order.size())
         {
-            outEntry = *it;
-            if (outIndex)
-                *outIndex = static_cast<int>(it - m_fileEntries.begin());
+            const AFPCK_ENTRYINFO& next = *requests[order[runLast]].entry;
+            const std::uint64_t nextEnd = std::max<std::uint64_t>(runEnd, next.dwOffset + static_cast<std::uint64_t>(next.dwCompressedLength));
+            if (next.dwOffset > runEnd + maxGap || nextEnd - runStart > MAX_COALESCED_READ)
+                break;
 
-            return true;
+            runEnd = nextEnd;
+            ++runLast;
+        }
+
+        // A mapping already serves views, and single entries gain nothing from staging
+        const bool staged = runLast - runBegin > 1 && !m_mapping.IsOpen();
+        if (staged)
+        {
+            const std::size_t runLength = static_cast<std::size_t>(runEnd - runStart);
+            if (t_runScratch.size() < runLength)
+                t_runScratch.resize(runLength);
+
+            if (!ReadRaw(runStart, std::span<std::byte>(t_runScratch.data(), runLength)))
+            {
+                result = false;
+                runBegin = runLast;
+                continue;
+            }
+
+            t_stagedOffset = runStart;
+            t_stagedData = std::span<const std::byte>(t_runScratch.data(), runLength);
+        }
+
+        for (std::size_t i = runBegin; i < runLast; ++i)
+        {
+            AFPCK_READREQUEST& request = requests[order[i]];
+            if (request.buffer.size() < request.entry->dwLength)
+            {
+                AFERRLOG(L"AFilePackage::ReadFiles(), Buffer too small: {} < {}", request.buffer.size(), request.entry->dwLength);
+                result = false;
+                continue;
+            }
+
+            request.succeeded = ReadFile(*request.entry, request.buffer, 0, request.bytesRead);
+            result = result && request.succeeded;
         }
+
+        t_stagedData = {};
+        runBegin = runLast;
     }
 
-    return false;
+    return result;
 }
 
-bool AFilePackage::GetFileEntryByIndex(int index, AFPCK_FILEENTRY& outEntry) const
+AEntryBuffer AFilePackage::ReadFileShared(const AFPCK_ENTRYINFO& entry)
 {
-    if (index < 0 || static_cast<size_t>(index) >= m_fileEntries.size())
+    TraceAccess(entry);
+
+    // Solid entries share their block's key and are served from the block cache instead
+    const bool cacheEnabled = m_entryCache.IsEnabled() && !(entry.dwFlags & AFPCK_ENTRY_SOLID);
+    if (cacheEnabled)
+    {
+        if (AEntryBuffer cached = m_entryCache.Find(PayloadKey(entry)))
+            return cached;
+    }
+
+    auto buffer = std::make_shared<std::vector<std::byte>>(entry.dwLength);
+    std::size_t bytesRead = 0;
+    if (!ReadFile(entry, *buffer, 0, bytesRead) || bytesRead != entry.dwLength)
+        return nullptr;
+
+    if (cacheEnabled)
+        m_entryCache.Insert(PayloadKey(entry), buffer);
+
+    return buffer;
+}
+
+std::future<AEntryBuffer> AFilePackage::ReadAsync(const AFPCK_ENTRYINFO& entry, ACancelToken cancel)
+{
+    AThreadPool* pool = GetAsyncPool(L"AFilePackage::ReadAsync()");
+    if (!pool)
+    {
+        std::promise<AEntryBuffer> failed;
+        failed.set_value(nullptr);
+        return failed.get_future();
+    }
+
+    return pool->Submit([this, entry, cancel = std::move(cancel), closing = m_closeToken]() -> AEntryBuffer {
+        if (cancel.IsCancelled() || closing.IsCancelled())
+            return nullptr;
+
+        return ReadFileShared(entry);
+    });
+}
+
+bool AFilePackage::ReadAsync(const AFPCK_ENTRYINFO& entry, std::function<void(AEntryBuffer)> onComplete, ACancelToken cancel)
+{
+    AThreadPool* pool = GetAsyncPool(L"AFilePackage::ReadAsync()");
+    if (!pool)
         return false;
 
-    outEntry = m_fileEntries[index];
+    pool->Enqueue([this, entry, onComplete = std::move(onComplete), cancel = std::move(cancel), closing = m_closeToken]() {
+        AEntryBuffer buffer;
+        if (!cancel.IsCancelled() && !closing.IsCancelled())
+            buffer = ReadFileShared(entry);
+
+        if (onComplete)
+            onComplete(std::move(buffer));
+    });
 
     return true;
 }
 
-bool AFilePackage::ResortEntries()
+std::size_t AFilePackage::Prefetch(std::span<const std::wstring_view> fileNames, ACancelToken cancel)
 {
-    std::sort(m_fileEntries.begin(), m_fileEntries.end(),
-        [](const AFPCK_FILEENTRY& a, const AFPCK_FILEENTRY& b) {
-            return std::strcmp(a.szFileName, b.szFileName) < 0;
+    if (!m_entryCache.IsEnabled())
+    {
+        AFERRLOG(L"AFilePackage::Prefetch(), Entry cache is disabled, see SetCacheBudget()");
+        return 0;
+    }
+
+    AThreadPool* pool = GetAsyncPool(L"AFilePackage::Prefetch()");
+    if (!pool)
+        return 0;
+
+    std::size_t queued = 0;
+    for (std::wstring_view fileName : fileNames)
+    {
+        const AFPCK_ENTRYINFO* entry = FindFile(fileName);
+        if (!entry)
+            continue;
+
+        pool->Enqueue([this, entry = *entry, cancel, closing = m_closeToken]() {
+            if (!cancel.IsCancelled() && !closing.IsCancelled())
+                ReadFileShared(entry);
         });
+        ++queued;
+    }
 
-    m_hasSorted = true;
+    return queued;
+}
+
+AThreadPool* AFilePackage::GetAsyncPool(const wchar_t* caller)
+{
+    // Background reads must not race with directory changes or the shared stream
+    if (!IsConcurrent())
+    {
+        AFERRLOG(L"{}, Package must be opened with AFPCK_OPEN_MAPPED or AFPCK_OPEN_CONCURRENT", caller);
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(m_asyncMutex);
+    if (!m_asyncPool)
+        m_asyncPool = std::make_unique<AThreadPool>(m_asyncWorkerCount);
+
+    return m_asyncPool.get();
+}
+
+void AFilePackage::TraceAccess(const AFPCK_ENTRYINFO& entry) const
+{
+    if (m_accessTrace.IsRecording())
+        m_accessTrace.Record(PayloadKey(entry));
+}
+
+bool AFilePackage::ReadBlockedFile(const AFPCK_ENTRYINFO& entry, std::span<std::byte> buffer, std::size_t offset, std::size_t& bytesRead)
+{
+    if (buffer.empty())
+        return true;
+
+    const ACodec* codec = GetEntryCodec(entry);
+    if (!codec)
+        return false;
+
+    // Payload layout: block size, block count, cumulative compressed block ends, block data
+    std::span<const std::byte> header;
+    if (!FetchRaw(entry.dwOffset, 2 * sizeof(std::uint32_t), t_tableScratch, header))
+        return false;
+
+    std::uint32_t blockSize = 0;
+    std::uint32_t blockCount = 0;
+    std::memcpy(&blockSize, header.data(), sizeof(blockSize));
+    std::memcpy(&blockCount, header.data() + sizeof(blockSize), sizeof(blockCount));
+
+    const std::uint64_t tableBytes = static_cast<std::uint64_t>(blockCount) * sizeof(std::uint32_t);
+    const std::uint64_t dataStart = 2 * sizeof(std::uint32_t) + tableBytes;
+    if (blockSize == 0 || blockCount != (static_cast<std::uint64_t>(entry.dwLength) + blockSize - 1) / blockSize ||
+        dataStart > entry.dwCompressedLength)
+    {
+        AFERRLOG(L"AFilePackage::ReadFile(), Corrupted block table");
+        return false;
+    }
+
+    // Only fetch the part of the block table covering the blocks we touch
+    const std::uint32_t firstBlock = static_cast<std::uint32_t>(offset / blockSize);
+    const std::uint32_t lastBlock = static_cast<std::uint32_t>((offset + buffer.size() - 1) / blockSize);
+    const std::uint32_t tableFirst = firstBlock > 0 ? firstBlock - 1 : 0;
+
+    std::span<const std::byte> tableBytesView;
+    if (!FetchRaw(entry.dwOffset + 2 * sizeof(std::uint32_t) + tableFirst * sizeof(std::uint32_t),
+        (lastBlock - tableFirst + 1) * sizeof(std::uint32_t), t_tableScratch, tableBytesView))
+        return false;
+
+    auto blockEnd = [&](std::uint32_t block) {
+        std::uint32_t end = 0;
+        std::memcpy(&end, tableBytesView.data() + (block - tableFirst) * sizeof(std::uint32_t), sizeof(end));
+        return end;
+    };
+
+    std::size_t written = 0;
+    for (std::uint32_t block = firstBlock; block <= lastBlock; ++block)
+    {
+        const std::uint32_t compStart = block > 0 ? blockEnd(block - 1) : 0;
+        const std::uint32_t compEnd = blockEnd(block);
+        const std::uint64_t rawStart = static_cast<std::uint64_t>(block) * blockSize;
+        const std::size_t rawLength = static_cast<std::size_t>(std::min<std::uint64_t>(blockSize, entry.dwLength - rawStart));
+        if (compEnd < compStart || dataStart + compEnd > entry.dwCompressedLength)
+        {
+            AFERRLOG(L"AFilePackage::ReadFile(), Corrupted block table");
+            return false;
+        }
+
+        std::span<const std::byte> compressed;
+        if (!FetchRaw(entry.dwOffset + dataStart + compStart, compEnd - compStart, t_compressedScratch, compressed))
+            return false;
+
+        // Slice of this block that lands in the caller's buffer
+        const std::size_t sliceStart = static_cast<std::size_t>(std::max<std::uint64_t>(offset, rawStart) - rawStart);
+        const std::size_t sliceLength = std::min(rawLength - sliceStart, buffer.size() - written);
+
+        if (compressed.size() == rawLength)
+        {
+            // Stored block
+            std::memcpy(buffer.data() + written, compressed.data() + sliceStart, sliceLength);
+        }
+        else
+        {
+            // Inflate straight into the caller's buffer when the whole block is wanted
+            const bool wholeBlock = sliceStart == 0 && sliceLength == rawLength;
+            if (!wholeBlock && t_blockScratch.size() < rawLength)
+                t_blockScratch.resize(rawLength);
+
+            std::byte* dest = wholeBlock ? buffer.data() + written : t_blockScratch.data();
+            if (!codec->Decompress(compressed, std::span<std::byte>(dest, rawLength)))
+            {
+                AFERRLOG(L"AFilePackage::ReadFile(), Decompression of block {} failed", block);
+                return false;
+            }
+
+            if (!wholeBlock)
+                std::memcpy(buffer.data() + written, t_blockScratch.data() + sliceStart, sliceLength);
+        }
+
+        written += sliceLength;
+    }
+
+    bytesRead = written;
 
     return true;
 }
 
-bool AFilePackage::LoadEntries()
+bool AFilePackage::ReadSolidFile(const AFPCK_ENTRYINFO& entry, std::span<std::byte> buffer, std::size_t offset, std::size_t& bytesRead)
 {
-    // Read file count
-    m_packageFile.seekg(-static_cast<std::streamoff>(sizeof(int) + sizeof(std::uint32_t)), std::ios::end);
-    int numFiles = 0;
-    m_packageFile.read(reinterpret_cast<char*>(&numFiles), sizeof(numFiles));
-    if (m_packageFile.fail() || numFiles < 0)
+    // The entry is a slice of its decoded block, which every entry of the block shares in the cache
+    const std::size_t sliceStart = ((entry.dwFlags & AFPCK_ENTRY_SOLID_OFFSET_MASK) >> AFPCK_ENTRY_SOLID_OFFSET_SHIFT) + offset;
+    const std::size_t sliceEnd = sliceStart - offset + entry.dwLength;
+    const std::uint64_t key = PayloadKey(entry);
+    // Checked first, so a disabled cache does not count misses
+    const bool cacheEnabled = m_blockCache.IsEnabled();
+    const AEntryBuffer cached = cacheEnabled ? m_blockCache.Find(key) : nullptr;
+    if (cached)
     {
-        AFERRLOG(L"AFilePackage::LoadEntries(), Invalid file count");
+        if (cached->size() < sliceEnd)
+        {
+            AFERRLOG(L"AFilePackage::ReadFile(), Corrupted solid block");
+            return false;
+        }
+
+        std::memcpy(buffer.data(), cached->data() + sliceStart, buffer.size());
+        bytesRead = buffer.size();
+        return true;
+    }
+
+    std::span<const std::byte> payload;
+    if (!FetchRaw(entry.dwOffset, entry.dwCompressedLength, t_compressedScratch, payload))
+        return false;
+
+    std::uint32_t decodedLength = 0;
+    if (!TakeValue(payload, decodedLength) || decodedLength < sliceEnd)
+    {
+        AFERRLOG(L"AFilePackage::ReadFile(), Corrupted solid block");
         return false;
     }
 
-    // Read header
-    m_packageFile.seekg(-static_cast<std::streamoff>(sizeof(AFPCK_FILEHEADER) + sizeof(std::uint32_t) + sizeof(int)), std::ios::end);
-    m_packageFile.read(reinterpret_cast<char*>(&m_header), sizeof(m_header));
-    if (m_packageFile.fail())
+    // Stored blocks are sliced in place
+    if (payload.size() == decodedLength)
+    {
+        std::memcpy(buffer.data(), payload.data() + sliceStart, buffer.size());
+        bytesRead = buffer.size();
+        return true;
+    }
+
+    const ACodec* codec = GetEntryCodec(entry);
+    if (!codec)
+        return false;
+
+    std::shared_ptr<std::vector<std::byte>> block;
+    if (cacheEnabled)
+        block = std::make_shared<std::vector<std::byte>>(decodedLength);
+    else if (t_blockScratch.size() < decodedLength)
+        t_blockScratch.resize(decodedLength);
+
+    std::byte* decoded = cacheEnabled ? block->data() : t_blockScratch.data();
+    if (!codec->Decompress(payload, std::span<std::byte>(decoded, decodedLength)))
     {
-        AFERRLOG(L"AFilePackage::LoadEntries(), Failed to read header");
+        AFERRLOG(L"AFilePackage::ReadFile(), Decompression of solid block failed");
         return false;
     }
 
-    // Load entries
-    m_fileEntries.resize(numFiles);
-    m_packageFile.seekg(m_header.dwEntryOffset);
-    for (int i = 0; i < numFiles; ++i)
+    std::memcpy(buffer.data(), decoded + sliceStart, buffer.size());
+    bytesRead = buffer.size();
+
+    if (cacheEnabled)
+        m_blockCache.Insert(key, std::move(block));
+
+    return true;
+}
+
+bool AFilePackage::ReadRaw(std::uint64_t offset, std::span<std::byte> buffer)
+{
+    if (buffer.empty())
+        return true;
+
+    std::span<const std::byte> staged;
+    if (FindStaged(offset, buffer.size(), staged))
     {
-        int nameLen = 0;
-        m_packageFile.read(reinterpret_cast<char*>(&nameLen), sizeof(nameLen));
-        if (nameLen <= 0 || nameLen > 260)
+        std::memcpy(buffer.data(), staged.data(), buffer.size());
+        return true;
+    }
+
+    if (m_mapping.IsOpen())
+    {
+        auto data = m_mapping.GetRange(offset, buffer.size());
+        if (data.size() != buffer.size())
         {
-            AFERRLOG(L"AFilePackage::LoadEntries(), Invalid filename length: {}", nameLen);
+            AFERRLOG(L"AFilePackage::ReadFile(), Entry data lies outside the package");
             return false;
         }
 
-        m_packageFile.read(m_fileEntries[i].szFileName, nameLen);
-        m_packageFile.read(reinterpret_cast<char*>(&m_fileEntries[i].dwOffset), sizeof(std::uint32_t));
-        m_packageFile.read(reinterpret_cast<char*>(&m_fileEntries[i].dwLength), sizeof(std::uint32_t));
-        m_packageFile.read(reinterpret_cast<char*>(&m_fileEntries[i].dwCompressedLength), sizeof(std::uint32_t));
+        std::memcpy(buffer.data(), data.data(), buffer.size());
+        return true;
+    }
 
-        if (m_packageFile.fail())
+    if (m_positionalFile.IsOpen())
+    {
+        if (!m_positionalFile.ReadAt(offset, buffer))
         {
-            AFERRLOG(L"AFilePackage::LoadEntries(), Failed to read entry {}", i);
+            AFERRLOG(L"AFilePackage::ReadFile(), Failed to read {} bytes at {}", buffer.size(), offset);
             return false;
         }
+
+        return true;
+    }
+
+    m_packageFile.clear();
+    m_packageFile.seekg(static_cast<std::streamoff>(offset));
+    m_packageFile.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+    if (m_packageFile.gcount() != static_cast<std::streamsize>(buffer.size()))
+    {
+        AFERRLOG(L"AFilePackage::ReadFile(), Failed to read {} bytes at {}", buffer.size(), offset);
+        return false;
     }
 
     return true;
 }
 
-bool AFilePackage::SaveEntries()
+bool AFilePackage::FetchRaw(std::uint64_t offset, std::size_t length, std::vector<std::byte>& scratch, std::span<const std::byte>& outData)
 {
-    if (m_readOnly)
-        return false;
+    if (FindStaged(offset, length, outData))
+        return true;
 
-    // Write entries
-    m_packageFile.seekp(m_header.dwEntryOffset);
-    for (const auto& entry : m_fileEntries)
+    // Mapped packages hand out views, everything else is staged in the scratch buffer
+    if (m_mapping.IsOpen())
     {
-        int nameLen = static_cast<int>(std::strlen(entry.szFileName)) + 1;
-        m_packageFile.write(reinterpret_cast<const char*>(&nameLen), sizeof(nameLen));
-        m_packageFile.write(entry.szFileName, nameLen);
-        m_packageFile.write(reinterpret_cast<const char*>(&entry.dwOffset), sizeof(entry.dwOffset));
-        m_packageFile.write(reinterpret_cast<const char*>(&entry.dwLength), sizeof(entry.dwLength));
-        m_packageFile.write(reinterpret_cast<const char*>(&entry.dwCompressedLength), sizeof(entry.dwCompressedLength));
+        outData = m_mapping.GetRange(offset, length);
+        if (outData.size() != length)
+        {
+            AFERRLOG(L"AFilePackage::ReadFile(), Entry data lies outside the package");
+            return false;
+        }
+
+        return true;
     }
 
-    // Write footer: header + count + version
-    m_packageFile.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header));
-    auto numFiles = static_cast<int>(m_fileEntries.size());
-    m_packageFile.write(reinterpret_cast<const char*>(&numFiles), sizeof(numFiles));
-    m_packageFile.write(reinterpret_cast<const char*>(&m_header.dwVersion), sizeof(m_header.dwVersion));
+    if (scratch.size() < length)
+        scratch.resize(length);
 
-    m_hasChanged = false;
+    if (!ReadRaw(offset, std::span<std::byte>(scratch.data(), length)))
+        return false;
+
+    outData = std::span<const std::byte>(scratch.data(), length);
 
     return true;
 }
 
-std::string AFilePackage::NormalizeFileName(std::wstring_view fileName) const
+std::span<const std::byte> AFilePackage::EncodePayload(std::string_view normalizedName, std::span<const std::byte> fileData, const ACodec* codec,
+    std::uint32_t dictionaryId, AFPCK_ENTRYINFO& entry, AFPCK_CATEGORYSTATS& outStats)
 {
-    std::wstring file(fileName);
-    return ::NormalizeFileName(ASTR_UNICODE_TO_UTF8(file));
+    outStats = {};
+    outStats.fileCount = 1;
+    outStats.rawBytes = fileData.size();
+
+    int level = Z_BEST_SPEED;
+    bool store = !IsAFCompressionEnabled() || !codec;
+    if (!store && m_compressionPolicy)
+    {
+        const auto begin = std::chrono::steady_clock::now();
+        const ACOMPRESSIONDECISION decision = m_compressionPolicy->Decide(normalizedName, fileData, *codec, level);
+        outStats.policySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        outStats.skippedFiles = decision.compress ? 0 : 1;
+        outStats.skippedBytes = decision.compress ? 0 : fileData.size();
+        store = !decision.compress;
+        level = decision.level;
+    }
+
+    if (store)
+    {
+        entry.dwLength = static_cast<std::uint32_t>(fileData.size());
+        entry.dwCompressedLength = entry.dwLength;
+        entry.dwFlags = 0;
+
+        outStats.storedBytes = fileData.size();
+
+        return fileData;
+    }
+
+    const auto begin = std::chrono::steady_clock::now();
+    const AEntryBuffer dictionary = dictionaryId != 0 ? GetDictionary(dictionaryId) : nullptr;
+    const std::span<const std::byte> payload = ::EncodePayload(fileData, *codec, level, m_compressionBuffer, entry,
+        dictionary ? dictionaryId : 0, dictionary ? std::span<const std::byte>(*dictionary) : std::span<const std::byte>());
+    outStats.compressSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    outStats.storedBytes = payload.size();
+
+    return payload;
 }
 
-bool OpenFilePackage(std::wstring_view packFile)
+void AFilePackage::AddCategoryStats(std::string_view normalizedName, const AFPCK_CATEGORYSTATS& delta)
 {
-    CloseFilePackage(); // ensure clean state
-    g_globalPackage = std::make_unique<AFilePackage>();
+    AFPCK_CATEGORYSTATS& stats = m_categoryStats[GetExtension(normalizedName)];
+    stats.fileCount += delta.fileCount;
+    stats.skippedFiles += delta.skippedFiles;
+    stats.rawBytes += delta.rawBytes;
+    stats.storedBytes += delta.storedBytes;
+    stats.skippedBytes += delta.skippedBytes;
+    stats.policySeconds += delta.policySeconds;
+    stats.compressSeconds += delta.compressSeconds;
+}
 
-    return g_globalPackage->Open(packFile, AFPCK_OPENMODE::AFPCK_OPENEXIST);
+std::map<std::string, AFPCK_CATEGORYSTATS> AFilePackage::GetCategoryStats() const
+{
+    // Skipped files are costed at the average rate of everything that was compressed
+    double compressSeconds = 0.0;
+    std::uint64_t compressedBytes = 0;
+    for (const auto& [extension, stats] : m_categoryStats)
+    {
+        compressSeconds += stats.compressSeconds;
+        compressedBytes += stats.rawBytes - stats.skippedBytes;
+    }
+
+    const double secondsPerByte = compressedBytes > 0 ? compressSeconds / static_cast<double>(compressedBytes) : 0.0;
+    std::map<std::string, AFPCK_CATEGORYSTATS> result;
+    for (const auto& [extension, stats] : m_categoryStats)
+    {
+        AFPCK_CATEGORYSTATS& report = result.emplace(extension, stats).first->second;
+        report.savedSeconds = static_cast<double>(stats.skippedBytes) * secondsPerByte - stats.policySeconds;
+    }
+
+    return result;
 }
 
-bool CloseFilePackage()
+bool AFilePackage::SetSolidBlocks(std::size_t maxFileLength)
 {
-    if (g_globalPackage)
+    if (maxFileLength > SOLID_BLOCK_SIZE)
     {
-        bool result = g_globalPackage->Close();
-        g_globalPackage.reset();
-        return result;
+        AFERRLOG(L"AFilePackage::SetSolidBlocks(), Files of {} bytes do not fit a solid block of {}", maxFileLength, SOLID_BLOCK_SIZE);
+        return false;
+    }
+
+    m_solidMaxLength = maxFileLength;
+
+    return true;
+}
+
+bool AFilePackage::SetDefaultCodec(std::uint32_t codecId)
+{
+    if (!ACodec_Find(codecId))
+    {
+        AFERRLOG(L"AFilePackage::SetDefaultCodec(), Unknown codec {}", codecId);
+        return false;
+    }
+
+    m_defaultCodec = codecId;
+
+    return true;
+}
+
+bool AFilePackage::SetExtensionCodec(std::wstring_view extension, std::uint32_t codecId)
+{
+    if (codecId != AFPCK_CODEC_AUTO && !ACodec_Find(codecId))
+    {
+        AFERRLOG(L"AFilePackage::SetExtensionCodec(), Unknown codec {}", codecId);
+        return false;
     }
 
+    if (!extension.empty() && extension.front() == L'.')
+        extension.remove_prefix(1);
+
+    std::string key = GetExtension("." + NormalizeFileName(extension));
+    if (codecId == AFPCK_CODEC_AUTO)
+        m_extensionCodecs.erase(key);
+    else
+        m_extensionCodecs[key] = codecId;
+
     return true;
 }
 
-AFilePackage* GetGlobalFilePackage()
+const ACodec* AFilePackage::SelectCodec(std::string_view normalizedName, std::uint32_t codecId) const
+{
+    if (codecId == AFPCK_CODEC_AUTO)
+    {
+        codecId = m_defaultCodec;
+        if (!m_extensionCodecs.empty())
+        {
+            auto it = m_extensionCodecs.find(GetExtension(normalizedName));
+            if (it != m_extensionCodecs.end())
+                codecId = it->second;
+        }
+    }
+
+    const ACodec* codec = ACodec_Find(codecId);
+    if (!codec)
+        AFERRLOG(L"AFilePackage::SelectCodec(), Unknown codec {}, storing uncompressed", codecId);
+
+    return codec;
+}
+
+std::uint32_t AFilePackage::SelectDictionary(std::string_view normalizedName, const ACodec* codec) const
+{
+    if (m_extensionDictionaries.empty() || !codec || codec->GetId() != ACODEC_ZLIB)
+        return 0;
+
+    auto it = m_extensionDictionaries.find(GetExtension(normalizedName));
+    return it != m_extensionDictionaries.end() ? it->second : 0;
+}
+
+std::uint32_t AFilePackage::TrainDictionary(std::wstring_view extension, std::span<const std::span<const std::byte>> samples, std::size_t maxBytes)
+{
+    const std::vector<std::byte> dictionary = ADictionary_Train(samples, maxBytes);
+    if (dictionary.empty())
+    {
+        AFERRLOG(L"AFilePackage::TrainDictionary(), The {} samples share no content", samples.size());
+        return 0;
+    }
+
+    const std::uint32_t dictionaryId = AddDictionary(dictionary);
+    if (dictionaryId == 0 || !SetExtensionDictionary(extension, dictionaryId))
+        return 0;
+
+    return dictionaryId;
+}
+
+std::uint32_t AFilePackage::AddDictionary(std::span<const std::byte> dictionary)
+{
+    if (m_readOnly)
+    {
+        AFERRLOG(L"AFilePackage::AddDictionary(), Read-only package");
+        return 0;
+    }
+
+    if (dictionary.empty() || dictionary.size() > ADICTIONARY_MAXSIZE)
+    {
+        AFERRLOG(L"AFilePackage::AddDictionary(), Dictionary of {} bytes, must be 1 to {}", dictionary.size(), ADICTIONARY_MAXSIZE);
+        return 0;
+    }
+
+    for (std::uint32_t dictionaryId = 1; dictionaryId <= AFPCK_MAX_DICTIONARY; ++dictionaryId)
+    {
+        const std::string name = GetDictionaryName(dictionaryId);
+        if (FindFile(std::string_view(name)))
+            continue;
+
+        // Stored, so loading a dictionary never needs another one
+        AFPCK_ENTRYINFO entry{};
+        entry.dwLength = static_cast<std::uint32_t>(dictionary.size());
+        entry.dwCompressedLength = entry.dwLength;
+        if (!WriteNewEntry(name, entry, dictionary))
+            return 0;
+
+        std::lock_guard<std::mutex> lock(m_dictionaryMutex);
+        m_dictionaries[dictionaryId] = std::make_shared<const std::vector<std::byte>>(dictionary.begin(), dictionary.end());
+
+        return dictionaryId;
+    }
+
+    AFERRLOG(L"AFilePackage::AddDictionary(), All {} dictionary ids are in use", AFPCK_MAX_DICTIONARY);
+    return 0;
+}
+
+bool AFilePackage::SetExtensionDictionary(std::wstring_view extension, std::uint32_t dictionaryId)
+{
+    if (dictionaryId != 0 && (dictionaryId > AFPCK_MAX_DICTIONARY || !GetDictionary(dictionaryId)))
+    {
+        AFERRLOG(L"AFilePackage::SetExtensionDictionary(), Unknown dictionary {}", dictionaryId);
+        return false;
+    }
+
+    if (!extension.empty() && extension.front() == L'.')
+        extension.remove_prefix(1);
+
+    std::string key = GetExtension("." + NormalizeFileName(extension));
+    if (dictionaryId == 0)
+        m_extensionDictionaries.erase(key);
+    else
+        m_extensionDictionaries[key] = dictionaryId;
+
+    return true;
+}
+
+AEntryBuffer AFilePackage::GetDictionary(std::uint32_t dictionaryId)
+{
+    std::lock_guard<std::mutex> lock(m_dictionaryMutex);
+    AEntryBuffer& dictionary = m_dictionaries[dictionaryId];
+    if (dictionary)
+        return dictionary;
+
+    const AFPCK_ENTRYINFO* entry = FindFile(std::string_view(GetDictionaryName(dictionaryId)));
+    auto buffer = std::make_shared<std::vector<std::byte>>(entry ? entry->dwLength : 0);
+    std::size_t bytesRead = 0;
+    if (!entry || !ReadFile(*entry, *buffer, 0, bytesRead) || bytesRead != entry->dwLength)
+    {
+        AFERRLOG(L"AFilePackage::GetDictionary(), Can not load preset dictionary {}", dictionaryId);
+        return nullptr;
+    }
+
+    dictionary = std::move(buffer);
+
+    return dictionary;
+}
+
+bool AFilePackage::GetFileView(const AFPCK_FILEENTRY& entry, std::span<const std::byte>& outView) const
+{
+    AFPCK_ENTRYINFO info{ entry.dwOffset, entry.dwLength, entry.dwCompressedLength, entry.dwFlags, 0, 0 };
+    return GetFileView(info, outView);
+}
+
+bool AFilePackage::GetFileView(const AFPCK_ENTRYINFO& entry, std::span<const std::byte>& outView) const
+{
+    TraceAccess(entry);
+
+    if (!m_mapping.IsOpen() || entry.dwCompressedLength < entry.dwLength || (entry.dwFlags & (AFPCK_ENTRY_BLOCKED | AFPCK_ENTRY_SOLID)))
+        return false;
+
+    auto payload = m_mapping.GetRange(entry.dwOffset, entry.dwLength);
+    if (payload.size() != entry.dwLength)
+        return false;
+
+    outView = payload;
+
+    return true;
+}
+
+bool AFilePackage::GetFileEntry(std::wstring_view fileName, AFPCK_FILEENTRY& outEntry, int* outIndex) const
+{
+    int index = FindEntryIndex(fileName);
+    if (index < 0)
+        return false;
+
+    ToFileEntry(m_fileEntries[index], outEntry);
+    if (outIndex)
+        *outIndex = index;
+
+    return true;
+}
+
+bool AFilePackage::GetFileEntry(std::string_view utf8Name, AFPCK_FILEENTRY& outEntry, int* outIndex) const
+{
+    int index = FindEntryIndex(TrimFileName(utf8Name));
+    if (index < 0)
+        return false;
+
+    ToFileEntry(m_fileEntries[index], outEntry);
+    if (outIndex)
+        *outIndex = index;
+
+    return true;
+}
+
+bool AFilePackage::GetFileEntry(AAssetId id, AFPCK_FILEENTRY& outEntry, int* outIndex) const
+{
+    int index = FindEntryIndexByHash(id.hash);
+    if (index < 0)
+        return false;
+
+    ToFileEntry(m_fileEntries[index], outEntry);
+    if (outIndex)
+        *outIndex = index;
+
+    return true;
+}
+
+const AFPCK_ENTRYINFO* AFilePackage::FindFile(std::wstring_view fileName) const
+{
+    int index = FindEntryIndex(fileName);
+    return index < 0 ? nullptr : &m_fileEntries[index];
+}
+
+const AFPCK_ENTRYINFO* AFilePackage::FindFile(std::string_view utf8Name) const
+{
+    int index = FindEntryIndex(TrimFileName(utf8Name));
+    return index < 0 ? nullptr : &m_fileEntries[index];
+}
+
+const AFPCK_ENTRYINFO* AFilePackage::FindFileByHash(std::uint64_t nameHash) const
+{
+    int index = FindEntryIndexByHash(nameHash);
+    return index < 0 ? nullptr : &m_fileEntries[index];
+}
+
+const AFPCK_ENTRYINFO* AFilePackage::FindFile(AAssetId id) const
+{
+    return FindFileByHash(id.hash);
+}
+
+const AFPCK_ENTRYINFO* AFilePackage::GetEntryByIndex(std::size_t index) const noexcept
+{
+    return index < m_fileEntries.size() ? &m_fileEntries[index] : nullptr;
+}
+
+std::string_view AFilePackage::GetEntryName(const AFPCK_ENTRYINFO& entry) const noexcept
+{
+    return std::string_view(m_namePool.data() + entry.dwNameOffset, entry.dwNameLength);
+}
+
+bool AFilePackage::GetFileEntryByIndex(int index, AFPCK_FILEENTRY& outEntry) const
+{
+    if (index < 0 || static_cast<size_t>(index) >= m_fileEntries.size())
+        return false;
+
+    ToFileEntry(m_fileEntries[index], outEntry);
+
+    return true;
+}
+
+bool AFilePackage::ResortEntries()
+{
+    std::sort(m_fileEntries.begin(), m_fileEntries.end(),
+        [this](const AFPCK_ENTRYINFO& a, const AFPCK_ENTRYINFO& b) {
+            return GetEntryName(a) < GetEntryName(b);
+        });
+
+    RebuildIndex();
+    m_hasSorted = true;
+
+    return true;
+}
+
+bool AFilePackage::LoadEntries()
+{
+    ResetJournal();
+    m_payloadRefs.clear();
+    m_payloadRefsBuilt = false;
+
+    m_packageFile.clear();
+    m_packageFile.seekg(0, std::ios::end);
+    const auto fileSize = static_cast<std::uint64_t>(m_packageFile.tellg());
+    if (m_packageFile.fail() || fileSize < LEGACY_FOOTER_SIZE)
+    {
+        AFERRLOG(L"AFilePackage::LoadEntries(), File too small");
+        return false;
+    }
+
+    // Read version from end
+    std::uint32_t version = 0;
+    std::span<std::byte> versionBytes(reinterpret_cast<std::byte*>(&version), sizeof(version));
+    if (!ReadRaw(fileSize - sizeof(version), versionBytes))
+        return false;
+
+    int numFiles = 0;
+    m_packageId = 0;
+    if (version >= LEGACY_VERSION && version < JOURNAL_VERSION)
+    {
+        // Legacy footer: header + count + version, right behind the directory
+        std::byte footer[LEGACY_FOOTER_SIZE];
+        if (!ReadRaw(fileSize - LEGACY_FOOTER_SIZE, footer))
+            return false;
+
+        AFPCK_FILEHEADER header{};
+        std::memcpy(&header, footer, sizeof(header));
+        std::memcpy(&numFiles, footer + sizeof(header), sizeof(numFiles));
+        m_header = WidenHeader(header);
+        m_footerOffset = fileSize - LEGACY_FOOTER_SIZE;
+        m_committedEnd = fileSize;
+    }
+    else
+    {
+        PACKAGESIGNATURE signature{};
+        if (fileSize >= SIGNATURE_SIZE && ReadRaw(0, std::span<std::byte>(reinterpret_cast<std::byte*>(&signature), sizeof(signature))) &&
+            IsSignature(signature))
+            m_packageId = signature.packageId;
+
+        const bool hasFooter = GetFooterSize(version) > LEGACY_FOOTER_SIZE;
+        bool found = hasFooter && ReadFooter(fileSize, version);
+        if (!found && hasFooter && m_packageId != 0)
+        {
+            // An unsigned package whose first payload happens to be a signed package
+            m_packageId = 0;
+            found = ReadFooter(fileSize, version);
+            if (!found)
+                m_packageId = signature.packageId;
+        }
+
+        // Only a signed package can have an interrupted commit or uncommitted payloads behind its last
+        // footer; anything else is not searched, so foreign files fail at once
+        if (!found && m_packageId != 0)
+        {
+            AFERRLOG(L"AFilePackage::LoadEntries(), No valid footer at the end (version {:#x}), searching for the last commit", version);
+            found = FindLastFooter(fileSize);
+        }
+
+        if (!found)
+        {
+            AFERRLOG(L"AFilePackage::LoadEntries(), Incorrect version! Got {:#x}", version);
+            return false;
+        }
+
+        numFiles = static_cast<int>(m_baseCount);
+    }
+
+    if (numFiles < 0 || m_header.dwEntryOffset > m_footerOffset)
+    {
+        AFERRLOG(L"AFilePackage::LoadEntries(), Invalid file count");
+        return false;
+    }
+
+    m_baseVersion = m_header.dwVersion;
+    m_baseCount = static_cast<std::uint32_t>(numFiles);
+
+    // Directory, index and journal state saved by SaveIndex() for exactly this commit
+    if (LoadIndexFile())
+        return true;
+
+    // Every entry takes at least a length, a one byte name and the fixed fields
+    const bool large = IsLarge();
+    const bool hasFlags = m_header.dwVersion >= 0x00010004u;
+    const std::size_t fixedBytes = large ? LARGE_ENTRY_FIELD_BYTES : (hasFlags ? 4 : 3) * sizeof(std::uint32_t);
+    const std::uint64_t regionEnd = m_footerOffset;
+    const std::uint64_t regionBytes = regionEnd - m_header.dwEntryOffset;
+    if (static_cast<std::uint64_t>(numFiles) * (sizeof(int) + 1 + fixedBytes) > regionBytes)
+    {
+        AFERRLOG(L"AFilePackage::LoadEntries(), Invalid file count");
+        return false;
+    }
+
+    // Load the base directory. It is fetched in large windows (or viewed in place when mapped)
+    // and parsed from memory, hashing the names on the way for the index build.
+    m_fileEntries.resize(numFiles);
+    m_namePool.clear();
+    m_namePool.reserve(static_cast<std::size_t>(regionBytes - static_cast<std::uint64_t>(numFiles) * (sizeof(int) - 1 + fixedBytes)));
+    m_deadNameBytes = 0;
+
+    std::vector<std::uint64_t> hashes(m_fileEntries.size());
+
+    std::uint64_t cursor = m_header.dwEntryOffset;
+    std::span<const std::byte> window;
+    std::vector<std::byte> scratch;
+
+    // Makes at least `need` bytes at the cursor available in the window
+    auto ensure = [&](std::size_t need) {
+        if (window.size() >= need)
+            return true;
+
+        const std::uint64_t available = regionEnd - cursor;
+        const auto length = static_cast<std::size_t>(std::min<std::uint64_t>(std::max(need, DIRECTORY_READ_SIZE), available));
+        return length >= need && FetchRaw(cursor, length, scratch, window);
+    };
+
+    for (int i = 0; i < numFiles; ++i)
+    {
+        int nameLen = 0;
+        if (!ensure(sizeof(nameLen)))
+        {
+            AFERRLOG(L"AFilePackage::LoadEntries(), Failed to read entry {}", i);
+            return false;
+        }
+
+        std::memcpy(&nameLen, window.data(), sizeof(nameLen));
+        if (nameLen <= 0 || nameLen > 260)
+        {
+            AFERRLOG(L"AFilePackage::LoadEntries(), Invalid filename length: {}", nameLen);
+            return false;
+        }
+
+        const std::size_t entryBytes = sizeof(nameLen) + nameLen + fixedBytes;
+        if (!ensure(entryBytes))
+        {
+            AFERRLOG(L"AFilePackage::LoadEntries(), Failed to read entry {}", i);
+            return false;
+        }
+
+        const auto* fileName = reinterpret_cast<const char*>(window.data() + sizeof(nameLen));
+        const std::string_view name(fileName, std::find(fileName, fileName + nameLen, '\0') - fileName);
+        AFPCK_ENTRYINFO& entry = m_fileEntries[i];
+        entry.dwNameOffset = AddEntryName(name);
+        entry.dwNameLength = static_cast<std::uint32_t>(name.size());
+
+        std::span<const std::byte> fields = window.subspan(sizeof(nameLen) + nameLen, fixedBytes);
+        if (!TakeEntryFields(fields, large, hasFlags, entry))
+        {
+            AFERRLOG(L"AFilePackage::LoadEntries(), Entry {} is larger than 4 GB", i);
+            return false;
+        }
+
+        hashes[i] = HashFileName(name);
+
+        cursor += entryBytes;
+        window = window.subspan(entryBytes);
+    }
+
+    const std::uint64_t directoryEnd = cursor;
+    BuildIndex(hashes);
+
+    // Legacy directories run up to the footer; journaled ones are followed by the first record or footer
+    m_baseDirBytes = (m_baseVersion < JOURNAL_VERSION ? m_footerOffset : directoryEnd) - m_header.dwEntryOffset;
+    m_metadataExtents.emplace_back(m_header.dwEntryOffset, m_baseDirBytes);
+    m_appendOffset = m_committedEnd;
+
+    m_hasSorted = false;
+
+    if (!ReplayJournal())
+        return false;
+
+    RebuildFreeExtents();
+
+    return true;
+}
+
+std::size_t AFilePackage::GetFooterSize(std::uint32_t version) noexcept
+{
+    if (version == LARGE_VERSION)
+        return LARGE_FOOTER_SIZE;
+
+    if (version >= JOURNAL_VERSION && version <= CURRENT_VERSION)
+        return FOOTER_SIZE;
+
+    return LEGACY_FOOTER_SIZE;
+}
+
+bool AFilePackage::ReadFooter(std::uint64_t footerEnd, std::uint32_t version)
+{
+    const std::size_t footerSize = GetFooterSize(version);
+    if (footerEnd < footerSize)
+        return false;
+
+    std::byte footer[LARGE_FOOTER_SIZE];
+    if (!ReadRaw(footerEnd - footerSize, std::span<std::byte>(footer, footerSize)))
+        return false;
+
+    return ParseFooter(std::span<const std::byte>(footer, footerSize), footerEnd);
+}
+
+bool AFilePackage::ParseFooter(std::span<const std::byte> footer, std::uint64_t footerEnd)
+{
+    // The size tells the format, since it was picked by the trailing version
+    const std::size_t footerSize = footer.size();
+    const bool large = footerSize == LARGE_FOOTER_SIZE;
+    const std::size_t crcOffset = large ? LARGE_FOOTER_CRC_OFFSET : FOOTER_CRC_OFFSET;
+    std::uint32_t storedCrc = 0;
+    std::memcpy(&storedCrc, footer.data() + crcOffset, sizeof(storedCrc));
+
+    std::byte check[LARGE_FOOTER_SIZE];
+    std::memcpy(check, footer.data(), footerSize);
+    std::memset(check + crcOffset, 0, sizeof(std::uint32_t));
+    if (Crc32(check, footerSize, FooterSeed(m_packageId)) != storedCrc)
+        return false;
+
+    AFPCK_FILEHEADER64 header{};
+    std::uint64_t journalOffset = 0;
+    std::uint32_t journalCount = 0;
+    int baseCount = 0;
+    if (large)
+    {
+        TakeValue(footer, header);
+        TakeValue(footer, journalOffset);
+    }
+    else
+    {
+        AFPCK_FILEHEADER narrow{};
+        std::uint32_t narrowOffset = 0;
+        TakeValue(footer, narrow);
+        TakeValue(footer, narrowOffset);
+        header = WidenHeader(narrow);
+        journalOffset = narrowOffset == LEGACY_NO_RECORD ? NO_RECORD : narrowOffset;
+    }
+
+    TakeValue(footer, journalCount);
+    TakeValue(footer, storedCrc);
+    TakeValue(footer, baseCount);
+
+    if (GetFooterSize(header.dwVersion) != footerSize || baseCount < 0 ||
+        header.dwEntryOffset > footerEnd - footerSize)
+        return false;
+
+    m_header = header;
+    m_journalOffset = journalOffset;
+    m_journalCount = journalCount;
+    m_baseCount = static_cast<std::uint32_t>(baseCount);
+    m_footerOffset = footerEnd - footerSize;
+    m_committedEnd = footerEnd;
+
+    return true;
+}
+
+bool AFilePackage::FindLastFooter(std::uint64_t fileSize)
+{
+    // Scan backwards for the newest footer whose CRC checks out; windows overlap by a footer
+    constexpr std::size_t WINDOW_SIZE = 0x100000;
+    std::vector<std::byte> window(WINDOW_SIZE);
+    std::uint64_t windowEnd = fileSize;
+    while (windowEnd >= FOOTER_SIZE)
+    {
+        const std::uint64_t windowStart = windowEnd > WINDOW_SIZE ? windowEnd - WINDOW_SIZE : 0;
+        const auto length = static_cast<std::size_t>(windowEnd - windowStart);
+        if (!ReadRaw(windowStart, std::span<std::byte>(window.data(), length)))
+            return false;
+
+        for (std::size_t end = length; end >= FOOTER_SIZE; --end)
+        {
+            std::uint32_t version = 0;
+            std::memcpy(&version, window.data() + end - sizeof(version), sizeof(version));
+            const std::size_t footerSize = GetFooterSize(version);
+            if (footerSize > LEGACY_FOOTER_SIZE && end >= footerSize && windowStart + end >= SIGNATURE_SIZE + footerSize &&
+                ParseFooter(std::span<const std::byte>(window.data() + end - footerSize, footerSize), windowStart + end))
+                return true;
+        }
+
+        if (windowStart == 0)
+            break;
+
+        windowEnd = windowStart + LARGE_FOOTER_SIZE - 1;
+    }
+
+    return false;
+}
+
+bool AFilePackage::LoadIndexFile()
+{
+    const std::wstring indexPath = m_packagePath + L".idx";
+    std::error_code error;
+    if (!std::filesystem::exists(indexPath, error))
+        return false;
+
+    AFileMapping mapping;
+    if (!mapping.Open(indexPath))
+        return false;
+
+    std::span<const std::byte> data = mapping.GetData();
+    INDEXFILEHEADER header{};
+    if (!TakeValue(data, header) || header.magic != INDEX_FILE_MAGIC || header.version != INDEX_FILE_VERSION)
+    {
+        AFERRLOG(L"AFilePackage::LoadEntries(), Ignoring invalid index file [{}]", indexPath);
+        return false;
+    }
+
+    // A stale index is expected after any commit and silently ignored
+    const std::size_t footerSize = GetFooterSize(m_baseVersion);
+    const auto packageTime = std::filesystem::last_write_time(m_packagePath, error).time_since_epoch().count();
+    std::byte footer[LARGE_FOOTER_SIZE];
+    if (error || header.packageSize != m_committedEnd || header.packageTime != packageTime ||
+        !ReadRaw(m_committedEnd - footerSize, std::span<std::byte>(footer, footerSize)) ||
+        Crc32(footer, footerSize) != header.footerCrc)
+        return false;
+
+    const std::size_t entryBytes = header.entryCount * INDEX_ENTRY_SIZE;
+    const std::size_t extentBytes = header.extentCount * INDEX_EXTENT_SIZE;
+    const std::size_t holeBytes = header.holeCount * INDEX_EXTENT_SIZE;
+    if (header.slotCount < 16 || (header.slotCount & (header.slotCount - 1)) != 0 ||
+        header.slotCount < header.entryCount * std::uint64_t(2) || header.slotCount > data.size() / INDEX_SLOT_SIZE ||
+        header.namePoolBytes > data.size() ||
+        data.size() != entryBytes + header.slotCount * INDEX_SLOT_SIZE + extentBytes + holeBytes + header.namePoolBytes)
+    {
+        AFERRLOG(L"AFilePackage::LoadEntries(), Ignoring invalid index file [{}]", indexPath);
+        return false;
+    }
+
+    // Decoded into the owned containers, the package edits them in place and the mapping is closed on return.
+    // The sizes were checked above, so the reads can not run short.
+    std::vector<AFPCK_ENTRYINFO> entries(header.entryCount);
+    for (AFPCK_ENTRYINFO& entry : entries)
+    {
+        TakeValue(data, entry.dwOffset);
+        TakeValue(data, entry.dwLength);
+        TakeValue(data, entry.dwCompressedLength);
+        TakeValue(data, entry.dwFlags);
+        TakeValue(data, entry.dwNameOffset);
+        TakeValue(data, entry.dwNameLength);
+    }
+
+    std::vector<INDEXSLOT> index(static_cast<std::size_t>(header.slotCount));
+    for (INDEXSLOT& slot : index)
+    {
+        TakeValue(data, slot.hash);
+        TakeValue(data, slot.index);
+    }
+
+    auto takeExtents = [&data](std::uint32_t count) {
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> extents(count);
+        for (auto& extent : extents)
+        {
+            TakeValue(data, extent.first);
+            TakeValue(data, extent.second);
+        }
+        return extents;
+    };
+
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> extents = takeExtents(header.extentCount);
+    const std::vector<std::pair<std::uint64_t, std::uint64_t>> holes = takeExtents(header.holeCount);
+    const auto* poolData = reinterpret_cast<const char*>(data.data());
+    std::vector<char> namePool(poolData, poolData + header.namePoolBytes);
+
+    // Only bounds are checked; the contents are trusted like the directory they were built from
+    const bool valid = std::all_of(entries.begin(), entries.end(), [&namePool](const AFPCK_ENTRYINFO& entry) {
+        return static_cast<std::uint64_t>(entry.dwNameOffset) + entry.dwNameLength < namePool.size() &&
+            namePool[entry.dwNameOffset + entry.dwNameLength] == '\0';
+    }) && std::all_of(index.begin(), index.end(), [&entries](const INDEXSLOT& slot) {
+        return slot.index == EMPTY_SLOT || slot.index < entries.size();
+    }) && std::all_of(holes.begin(), holes.end(), [this](const std::pair<std::uint64_t, std::uint64_t>& hole) {
+        return hole.second <= m_committedEnd && hole.first <= m_committedEnd - hole.second;
+    });
+
+    if (!valid)
+    {
+        AFERRLOG(L"AFilePackage::LoadEntries(), Ignoring invalid index file [{}]", indexPath);
+        return false;
+    }
+
+    m_fileEntries = std::move(entries);
+    m_index = std::move(index);
+    m_namePool = std::move(namePool);
+    m_deadNameBytes = 0;
+    m_metadataExtents = std::move(extents);
+    m_baseDirBytes = header.baseDirBytes;
+    m_journalBytes = header.journalBytes;
+    m_appendOffset = m_committedEnd;
+    m_hasSorted = true;
+
+    // Saves the offset sort of RebuildFreeExtents()
+    m_freeExtents.clear();
+    m_freeBySize.clear();
+    m_pendingFree.clear();
+    m_freeBytes = 0;
+    if (!m_readOnly)
+    {
+        for (const auto& [offset, length] : holes)
+            InsertFreeExtent(offset, length);
+    }
+
+    return true;
+}
+
+bool AFilePackage::SaveIndex()
+{
+    if (!m_packageFile.is_open())
+    {
+        AFERRLOG(L"AFilePackage::SaveIndex(), Package is not open");
+        return false;
+    }
+
+    // The index describes the committed package only
+    if (m_hasChanged && !Commit())
+        return false;
+
+    m_packageFile.flush();
+    if (!m_hasSorted)
+        ResortEntries();
+
+    if (m_deadNameBytes > 0)
+        CompactNamePool();
+
+    // Every open mode can read the package back, through the stream, the mapping or positional reads
+    const std::size_t footerSize = GetFooterSize(m_baseVersion);
+    std::byte footer[LARGE_FOOTER_SIZE];
+    std::error_code error;
+    const auto packageTime = std::filesystem::last_write_time(m_packagePath, error).time_since_epoch().count();
+    if (m_committedEnd < footerSize || error || !ReadRaw(m_committedEnd - footerSize, std::span(footer, footerSize)))
+    {
+        AFERRLOG(L"AFilePackage::SaveIndex(), Can not read the footer of [{}]", m_packagePath);
+        return false;
+    }
+
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> holes;
+    CollectHoles(holes);
+
+    INDEXFILEHEADER header{};
+    header.magic = INDEX_FILE_MAGIC;
+    header.version = INDEX_FILE_VERSION;
+    header.packageSize = m_committedEnd;
+    header.packageTime = packageTime;
+    header.footerCrc = Crc32(footer, footerSize);
+    header.entryCount = static_cast<std::uint32_t>(m_fileEntries.size());
+    header.slotCount = m_index.size();
+    header.namePoolBytes = m_namePool.size();
+    header.extentCount = static_cast<std::uint32_t>(m_metadataExtents.size());
+    header.holeCount = static_cast<std::uint32_t>(holes.size());
+    header.baseDirBytes = m_baseDirBytes;
+    header.journalBytes = m_journalBytes;
+
+    std::vector<char> buffer;
+    buffer.reserve(sizeof(header) + m_fileEntries.size() * INDEX_ENTRY_SIZE + m_index.size() * INDEX_SLOT_SIZE +
+        (m_metadataExtents.size() + holes.size()) * INDEX_EXTENT_SIZE + m_namePool.size());
+    AppendValue(buffer, header);
+    for (const AFPCK_ENTRYINFO& entry : m_fileEntries)
+    {
+        AppendValue(buffer, entry.dwOffset);
+        AppendValue(buffer, entry.dwLength);
+        AppendValue(buffer, entry.dwCompressedLength);
+        AppendValue(buffer, entry.dwFlags);
+        AppendValue(buffer, entry.dwNameOffset);
+        AppendValue(buffer, entry.dwNameLength);
+    }
+
+    for (const INDEXSLOT& slot : m_index)
+    {
+        AppendValue(buffer, slot.hash);
+        AppendValue(buffer, slot.index);
+    }
+
+    auto appendExtents = [&buffer](const std::vector<std::pair<std::uint64_t, std::uint64_t>>& extents) {
+        for (const auto& [offset, length] : extents)
+        {
+            AppendValue(buffer, offset);
+            AppendValue(buffer, length);
+        }
+    };
+
+    appendExtents(m_metadataExtents);
+    appendExtents(holes);
+
+    buffer.insert(buffer.end(), m_namePool.begin(), m_namePool.end());
+
+    // Written aside and renamed into place, so a reader never sees a partial index
+    const std::wstring indexPath = m_packagePath + L".idx";
+    const std::wstring tempPath = indexPath + L".tmp";
+    std::ofstream indexFile(std::filesystem::path(tempPath), std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!indexFile)
+    {
+        AFERRLOG(L"AFilePackage::SaveIndex(), Can not create file [{}]", tempPath);
+        return false;
+    }
+
+    indexFile.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    indexFile.close();
+    if (indexFile.fail())
+    {
+        AFERRLOG(L"AFilePackage::SaveIndex(), Failed to write [{}]", tempPath);
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+
+    std::filesystem::rename(tempPath, indexPath, error);
+    if (error)
+    {
+        AFERRLOG(L"AFilePackage::SaveIndex(), Can not replace [{}]", indexPath);
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+
+    return true;
+}
+
+bool AFilePackage::ReplayJournal()
+{
+    const bool large = IsLarge();
+    const std::size_t headerSize = large ? LARGE_RECORD_HEADER_SIZE : RECORD_HEADER_SIZE;
+
+    // Record header fields: previous record offset, op count and body length
+    auto parseHeader = [large](std::span<const std::byte> data, std::uint64_t& previous, std::uint32_t& opCount, std::uint32_t& bodyLength) {
+        std::uint32_t magic = 0;
+        TakeValue(data, magic);
+        if (large)
+            TakeValue(data, previous);
+        else
+        {
+            std::uint32_t narrow = 0;
+            TakeValue(data, narrow);
+            previous = narrow == LEGACY_NO_RECORD ? NO_RECORD : narrow;
+        }
+
+        TakeValue(data, opCount);
+        TakeValue(data, bodyLength);
+
+        return magic == JOURNAL_MAGIC;
+    };
+
+    // Walk the chain from the newest record back, then apply the records oldest first
+    std::vector<std::pair<std::uint64_t, std::vector<std::byte>>> records;
+    for (std::uint64_t offset = m_journalOffset; offset != NO_RECORD;)
+    {
+        if (records.size() >= m_journalCount)
+        {
+            AFERRLOG(L"AFilePackage::LoadEntries(), Journal chain longer than {} records", m_journalCount);
+            return false;
+        }
+
+        std::byte header[LARGE_RECORD_HEADER_SIZE];
+        if (offset > m_footerOffset || headerSize > m_footerOffset - offset ||
+            !ReadRaw(offset, std::span<std::byte>(header, headerSize)))
+            return false;
+
+        std::uint64_t previous = 0;
+        std::uint32_t opCount = 0;
+        std::uint32_t bodyLength = 0;
+        const bool valid = parseHeader(std::span<const std::byte>(header, headerSize), previous, opCount, bodyLength);
+        const std::uint64_t recordSize = headerSize + static_cast<std::uint64_t>(bodyLength) + sizeof(std::uint32_t);
+        if (!valid || offset + recordSize > m_footerOffset)
+        {
+            AFERRLOG(L"AFilePackage::LoadEntries(), Corrupted journal record at {}", offset);
+            return false;
+        }
+
+        std::vector<std::byte> record(static_cast<std::size_t>(recordSize));
+        if (!ReadRaw(offset, record))
+            return false;
+
+        std::uint32_t storedCrc = 0;
+        std::memcpy(&storedCrc, record.data() + record.size() - sizeof(storedCrc), sizeof(storedCrc));
+        if (Crc32(record.data(), record.size() - sizeof(storedCrc)) != storedCrc)
+        {
+            AFERRLOG(L"AFilePackage::LoadEntries(), Journal record at {} fails its checksum", offset);
+            return false;
+        }
+
+        records.emplace_back(offset, std::move(record));
+        offset = previous;
+    }
+
+    for (auto it = records.rbegin(); it != records.rend(); ++it)
+    {
+        const std::uint64_t recordOffset = it->first;
+        std::uint64_t previous = 0;
+        std::uint32_t opCount = 0;
+        std::uint32_t bodyLength = 0;
+        parseHeader(it->second, previous, opCount, bodyLength);
+        std::span<const std::byte> body(it->second.data() + headerSize, bodyLength);
+
+        for (std::uint32_t op = 0; op < opCount; ++op)
+        {
+            std::uint8_t kind = 0;
+            int nameLen = 0;
+            if (!TakeValue(body, kind) || !TakeValue(body, nameLen) || nameLen <= 0 ||
+                nameLen > static_cast<int>(MAX_NAME_LENGTH + 1) || body.size() < static_cast<std::size_t>(nameLen))
+            {
+                AFERRLOG(L"AFilePackage::LoadEntries(), Corrupted journal record at {}", recordOffset);
+                return false;
+            }
+
+            const auto* nameData = reinterpret_cast<const char*>(body.data());
+            const std::string_view name(nameData, std::find(nameData, nameData + nameLen, '\0') - nameData);
+            body = body.subspan(nameLen);
+            const int index = FindEntryIndex(name);
+
+            if (kind == JOURNAL_REMOVE)
+            {
+                if (index >= 0)
+                    EraseEntry(index);
+
+                continue;
+            }
+
+            AFPCK_ENTRYINFO entry{};
+            if (kind != JOURNAL_PUT || !TakeEntryFields(body, large, true, entry))
+            {
+                AFERRLOG(L"AFilePackage::LoadEntries(), Corrupted journal record at {}", recordOffset);
+                return false;
+            }
+
+            if (index >= 0)
+            {
+                AFPCK_ENTRYINFO& existing = m_fileEntries[index];
+                existing.dwOffset = entry.dwOffset;
+                existing.dwLength = entry.dwLength;
+                existing.dwCompressedLength = entry.dwCompressedLength;
+                existing.dwFlags = entry.dwFlags;
+            }
+            else
+                AddEntry(name, entry);
+        }
+
+        m_metadataExtents.emplace_back(recordOffset, it->second.size());
+        m_journalBytes += it->second.size();
+    }
+
+    return true;
+}
+
+void AFilePackage::ResetJournal()
+{
+    m_dirtyNames.clear();
+    m_metadataExtents.clear();
+    m_baseVersion = 0;
+    m_baseCount = 0;
+    m_baseDirBytes = 0;
+    m_journalOffset = NO_RECORD;
+    m_journalCount = 0;
+    m_journalBytes = 0;
+    m_footerOffset = 0;
+    m_appendOffset = 0;
+    m_committedEnd = 0;
+}
+
+bool AFilePackage::Commit()
+{
+    if (m_readOnly)
+    {
+        AFERRLOG(L"AFilePackage::Commit(), Read-only package");
+        return false;
+    }
+
+    return !m_hasChanged || SaveEntries();
+}
+
+bool AFilePackage::SaveEntries()
+{
+    if (m_readOnly)
+        return false;
+
+    // Legacy packages and long journals get a full directory; otherwise only the changed entries are recorded
+    const bool fullDirectory = m_baseVersion < JOURNAL_VERSION || m_journalCount >= MAX_JOURNAL_RECORDS ||
+        m_journalBytes > m_baseDirBytes / 2 + JOURNAL_SLACK_BYTES;
+    if (!fullDirectory && m_dirtyNames.empty())
+    {
+        m_hasChanged = false;
+        return true;
+    }
+
+    const bool large = IsLarge();
+    const std::uint64_t writeOffset = m_appendOffset;
+    AFPCK_FILEHEADER64 header = m_header;
+    header.dwVersion = large ? LARGE_VERSION : CURRENT_VERSION;
+
+    std::vector<char> buffer;
+    std::uint64_t journalOffset = NO_RECORD;
+    std::uint32_t journalCount = 0;
+    std::uint32_t baseCount = m_baseCount;
+    if (fullDirectory)
+    {
+        BuildDirectory(buffer);
+        header.dwEntryOffset = writeOffset;
+        baseCount = static_cast<std::uint32_t>(m_fileEntries.size());
+    }
+    else
+    {
+        AppendValue(buffer, JOURNAL_MAGIC);
+        if (large)
+            AppendValue(buffer, m_journalOffset);
+        else
+            AppendValue(buffer, static_cast<std::uint32_t>(m_journalOffset));
+        AppendValue(buffer, static_cast<std::uint32_t>(m_dirtyNames.size()));
+        AppendValue(buffer, std::uint32_t{ 0 });
+
+        for (const std::string& name : m_dirtyNames)
+        {
+            const int index = FindEntryIndex(name);
+            if (index >= 0)
+            {
+                AppendValue(buffer, JOURNAL_PUT);
+                AppendEntry(buffer, m_fileEntries[index]);
+            }
+            else
+            {
+                AppendValue(buffer, JOURNAL_REMOVE);
+                AppendValue(buffer, static_cast<int>(name.size() + 1));
+                buffer.insert(buffer.end(), name.c_str(), name.c_str() + name.size() + 1);
+            }
+        }
+
+        // The body length is the last header field
+        const std::size_t headerSize = large ? LARGE_RECORD_HEADER_SIZE : RECORD_HEADER_SIZE;
+        const auto bodyLength = static_cast<std::uint32_t>(buffer.size() - headerSize);
+        std::memcpy(buffer.data() + headerSize - sizeof(bodyLength), &bodyLength, sizeof(bodyLength));
+        AppendValue(buffer, Crc32(buffer.data(), buffer.size()));
+
+        journalOffset = writeOffset;
+        journalCount = m_journalCount + 1;
+    }
+
+    const std::size_t metadataLength = buffer.size();
+    BuildFooter(buffer, header, journalOffset, journalCount, baseCount);
+    const std::size_t footerSize = buffer.size() - metadataLength;
+    if (!FitsFormat(writeOffset + buffer.size()))
+    {
+        AFERRLOG(L"AFilePackage::SaveEntries(), Package would exceed 4 GB; create it with AFPCK_CREATE_LARGE");
+        return false;
+    }
+
+    // Payloads and the directory or record reach the disk first, then the footer that makes them
+    // the current commit; a crash in between leaves the previous footer as the last valid one
+    m_packageFile.clear();
+    m_packageFile.seekp(writeOffset);
+    m_packageFile.write(buffer.data(), static_cast<std::streamsize>(metadataLength));
+    m_packageFile.flush();
+    const bool recordsSynced = !m_packageFile.fail() && AFile_SyncToDisk(m_packagePath);
+    if (recordsSynced)
+    {
+        m_packageFile.write(buffer.data() + metadataLength, static_cast<std::streamsize>(footerSize));
+        m_packageFile.flush();
+    }
+
+    if (!recordsSynced || m_packageFile.fail() || !AFile_SyncToDisk(m_packagePath))
+    {
+        AFERRLOG(L"AFilePackage::SaveEntries(), Failed to write {} bytes at {}", buffer.size(), writeOffset);
+        return false;
+    }
+
+    // Space the new commit no longer references becomes reusable
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> released = std::move(m_pendingFree);
+    m_pendingFree.clear();
+    if (m_committedEnd > m_footerOffset)
+        released.emplace_back(m_footerOffset, m_committedEnd - m_footerOffset);
+
+    if (fullDirectory)
+    {
+        released.insert(released.end(), m_metadataExtents.begin(), m_metadataExtents.end());
+        m_metadataExtents.clear();
+        m_baseVersion = header.dwVersion;
+        m_baseDirBytes = metadataLength;
+        m_journalBytes = 0;
+    }
+    else
+        m_journalBytes += metadataLength;
+
+    m_metadataExtents.emplace_back(writeOffset, metadataLength);
+    m_header = header;
+    m_baseCount = baseCount;
+    m_journalOffset = journalOffset;
+    m_journalCount = journalCount;
+    m_footerOffset = writeOffset + metadataLength;
+    m_committedEnd = m_footerOffset + footerSize;
+    m_appendOffset = m_committedEnd;
+
+    for (const auto& [offset, length] : released)
+        InsertFreeExtent(offset, length);
+
+    m_dirtyNames.clear();
+    m_hasChanged = false;
+
+    return true;
+}
+
+void AFilePackage::AppendEntry(std::vector<char>& out, const AFPCK_ENTRYINFO& entry) const
+{
+    const int nameLen = static_cast<int>(entry.dwNameLength) + 1;
+    AppendValue(out, nameLen);
+    out.insert(out.end(), m_namePool.data() + entry.dwNameOffset, m_namePool.data() + entry.dwNameOffset + nameLen);
+    if (IsLarge())
+    {
+        AppendValue(out, entry.dwOffset);
+        AppendValue(out, static_cast<std::uint64_t>(entry.dwLength));
+        AppendValue(out, static_cast<std::uint64_t>(entry.dwCompressedLength));
+    }
+    else
+    {
+        AppendValue(out, static_cast<std::uint32_t>(entry.dwOffset));
+        AppendValue(out, entry.dwLength);
+        AppendValue(out, entry.dwCompressedLength);
+    }
+    AppendValue(out, entry.dwFlags);
+}
+
+void AFilePackage::BuildDirectory(std::vector<char>& out) const
+{
+    for (const auto& entry : m_fileEntries)
+        AppendEntry(out, entry);
+}
+
+void AFilePackage::BuildFooter(std::vector<char>& out, const AFPCK_FILEHEADER64& header, std::uint64_t journalOffset,
+    std::uint32_t journalCount, std::uint32_t baseCount) const
+{
+    const bool large = header.dwVersion == LARGE_VERSION;
+    const std::size_t start = out.size();
+    if (large)
+    {
+        AppendValue(out, header);
+        AppendValue(out, journalOffset);
+    }
+    else
+    {
+        AppendValue(out, NarrowHeader(header));
+        AppendValue(out, static_cast<std::uint32_t>(journalOffset));
+    }
+    AppendValue(out, journalCount);
+    AppendValue(out, std::uint32_t{ 0 });
+    AppendValue(out, static_cast<int>(baseCount));
+    AppendValue(out, header.dwVersion);
+
+    const std::uint32_t crc = Crc32(out.data() + start, out.size() - start, FooterSeed(m_packageId));
+    std::memcpy(out.data() + start + (large ? LARGE_FOOTER_CRC_OFFSET : FOOTER_CRC_OFFSET), &crc, sizeof(crc));
+}
+
+bool AFilePackage::FitsFormat(std::uint64_t end) const noexcept
+{
+    return IsLarge() || end <= MAX_LEGACY_SIZE;
+}
+
+bool AFilePackage::Compact(AFPCK_COMPACTSTATS* outStats, std::span<const std::uint32_t> entryOrder)
+{
+    if (m_readOnly || m_mode != AFPCK_OPENMODE::AFPCK_OPENEXIST || !m_packageFile.is_open())
+    {
+        AFERRLOG(L"AFilePackage::Compact(), Package must be opened writable with AFPCK_OPENEXIST");
+        return false;
+    }
+
+    // Layout order: the requested entries first, then the rest in their current offset order
+    std::vector<std::uint32_t> order;
+    order.reserve(m_fileEntries.size());
+    std::vector<bool> placed(m_fileEntries.size(), false);
+    for (std::uint32_t index : entryOrder)
+    {
+        if (index < m_fileEntries.size() && !placed[index])
+        {
+            placed[index] = true;
+            order.push_back(index);
+        }
+    }
+
+    const std::size_t requested = order.size();
+    for (std::uint32_t i = 0; i < m_fileEntries.size(); ++i)
+    {
+        if (!placed[i])
+            order.push_back(i);
+    }
+
+    std::sort(order.begin() + requested, order.end(), [this](std::uint32_t a, std::uint32_t b) {
+        return m_fileEntries[a].dwOffset < m_fileEntries[b].dwOffset;
+    });
+
+    std::error_code error;
+    const std::uint64_t oldSize = std::filesystem::file_size(m_packagePath, error);
+
+    // Stream the live payloads into a temporary package; the original stays intact until the final rename
+    const std::wstring tempPath = m_packagePath + L".compact";
+    std::ofstream tempFile(std::filesystem::path(tempPath), std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!tempFile)
+    {
+        AFERRLOG(L"AFilePackage::Compact(), Can not create file [{}]", tempPath);
+        return false;
+    }
+
+    std::vector<std::uint64_t> oldOffsets(m_fileEntries.size());
+    for (std::size_t i = 0; i < m_fileEntries.size(); ++i)
+        oldOffsets[i] = m_fileEntries[i].dwOffset;
+
+    // The rewritten package is signed; an unsigned one gets its first signature here
+    const std::uint64_t oldPackageId = m_packageId;
+    const PACKAGESIGNATURE signature = MakeSignature(m_packageId);
+    m_packageId = signature.packageId;
+    tempFile.write(reinterpret_cast<const char*>(&signature), sizeof(signature));
+
+    std::vector<std::byte> chunk(COMPACT_CHUNK_SIZE);
+    // Entries sharing a payload keep sharing it; PayloadKey() tells empty payloads from one at the same offset
+    std::unordered_map<std::uint64_t, std::uint64_t> movedOffsets;
+    std::vector<std::uint64_t> newOffsets(m_fileEntries.size());
+    std::uint64_t cursor = SIGNATURE_SIZE;
+    bool result = true;
+    for (std::uint32_t index : order)
+    {
+        const AFPCK_ENTRYINFO& entry = m_fileEntries[index];
+        const std::uint64_t extentKey = PayloadKey(entry);
+        auto moved = movedOffsets.find(extentKey);
+        if (moved != movedOffsets.end())
+        {
+            newOffsets[index] = moved->second;
+            continue;
+        }
+
+        if (!FitsFormat(cursor + entry.dwCompressedLength))
+        {
+            AFERRLOG(L"AFilePackage::Compact(), Package exceeds 4 GB");
+            result = false;
+            break;
+        }
+
+        newOffsets[index] = cursor;
+        movedOffsets.emplace(extentKey, newOffsets[index]);
+
+        for (std::uint32_t copied = 0; copied < entry.dwCompressedLength;)
+        {
+            const std::size_t length = std::min<std::size_t>(chunk.size(), entry.dwCompressedLength - copied);
+            if (!ReadRaw(entry.dwOffset + copied, std::span<std::byte>(chunk.data(), length)))
+            {
+                result = false;
+                break;
+            }
+
+            tempFile.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(length));
+            copied += static_cast<std::uint32_t>(length);
+        }
+
+        if (!result)
+            break;
+
+        cursor += entry.dwCompressedLength;
+    }
+
+    if (result)
+    {
+        for (std::size_t i = 0; i < m_fileEntries.size(); ++i)
+            m_fileEntries[i].dwOffset = newOffsets[i];
+
+        // A single full directory; the journal starts over
+        AFPCK_FILEHEADER64 header = m_header;
+        header.dwVersion = IsLarge() ? LARGE_VERSION : CURRENT_VERSION;
+        header.dwEntryOffset = cursor;
+
+        std::vector<char> directory;
+        BuildDirectory(directory);
+        BuildFooter(directory, header, NO_RECORD, 0, static_cast<std::uint32_t>(m_fileEntries.size()));
+        tempFile.write(directory.data(), static_cast<std::streamsize>(directory.size()));
+    }
+
+    // The temporary package must be on disk before it replaces the original, or a crash after the
+    // rename could leave a partial package in its place
+    tempFile.close();
+    if (result && !tempFile.fail() && !AFile_SyncToDisk(tempPath))
+        result = false;
+
+    if (!result || tempFile.fail())
+    {
+        AFERRLOG(L"AFilePackage::Compact(), Failed to write [{}]", tempPath);
+        for (std::size_t i = 0; i < m_fileEntries.size(); ++i)
+            m_fileEntries[i].dwOffset = oldOffsets[i];
+
+        m_packageId = oldPackageId;
+
+        std::error_code removeError;
+        std::filesystem::remove(tempPath, removeError);
+        return false;
+    }
+
+    m_packageFile.close();
+    std::error_code renameError;
+    std::filesystem::rename(tempPath, m_packagePath, renameError);
+    if (renameError)
+    {
+        AFERRLOG(L"AFilePackage::Compact(), Can not replace [{}]", m_packagePath);
+        for (std::size_t i = 0; i < m_fileEntries.size(); ++i)
+            m_fileEntries[i].dwOffset = oldOffsets[i];
+
+        m_packageId = oldPackageId;
+
+        std::error_code removeError;
+        std::filesystem::remove(tempPath, removeError);
+    }
+
+    // A failed rename leaves the original package in place; reopen it but still report the failure
+    m_packageFile.open(std::filesystem::path(m_packagePath), std::ios::binary | std::ios::in | std::ios::out);
+    if (!m_packageFile)
+    {
+        AFERRLOG(L"AFilePackage::Compact(), Can not reopen file [{}]", m_packagePath);
+        return false;
+    }
+
+    if (renameError)
+        return false;
+
+    // The new package is complete either way; this only makes the rename itself durable
+    const std::wstring packageFolder = std::filesystem::path(m_packagePath).parent_path().wstring();
+    AFile_SyncDirectory(packageFolder);
+
+    // Dedup candidates follow their payloads; those no entry references any more are dropped
+    for (auto it = m_dedupPayloads.begin(); it != m_dedupPayloads.end();)
+    {
+        auto moved = movedOffsets.find(PayloadKey(it->second));
+        if (moved == movedOffsets.end())
+        {
+            it = m_dedupPayloads.erase(it);
+            continue;
+        }
+
+        it->second.dwOffset = moved->second;
+        ++it;
+    }
+
+    // Offsets moved, so cached buffers are keyed wrongly; the new layout has no holes
+    m_entryCache.Clear();
+    m_blockCache.Clear();
+    if (!LoadEntries())
+        return false;
+
+    m_hasChanged = false;
+
+    const std::uint64_t newSize = std::filesystem::file_size(m_packagePath, error);
+    if (outStats)
+    {
+        outStats->oldSize = oldSize;
+        outStats->newSize = newSize;
+        outStats->reclaimedBytes = oldSize > newSize ? oldSize - newSize : 0;
+        outStats->entryCount = m_fileEntries.size();
+    }
+
+    return true;
+}
+
+bool AFilePackage::SaveAccessTrace(std::wstring_view tracePath) const
+{
+    if (!m_packageFile.is_open())
+    {
+        AFERRLOG(L"AFilePackage::SaveAccessTrace(), Package is not open");
+        return false;
+    }
+
+    // Payloads recorded by key are named after the first entry that stores them
+    std::unordered_map<std::uint64_t, std::uint32_t> payloadEntries;
+    payloadEntries.reserve(m_fileEntries.size());
+    for (std::uint32_t i = 0; i < m_fileEntries.size(); ++i)
+        payloadEntries.try_emplace(PayloadKey(m_fileEntries[i]), i);
+
+    const std::vector<std::string> phases = m_accessTrace.GetPhases();
+    std::string text;
+    for (const AACCESSTRACE_RECORD& record : m_accessTrace.GetRecords())
+    {
+        auto it = payloadEntries.find(record.key);
+        if (it == payloadEntries.end())
+            continue;
+
+        text.append(phases[record.phase]).append(1, '\t');
+        text.append(std::to_string(record.micros)).append(1, '\t');
+        text.append(GetEntryName(m_fileEntries[it->second])).append(1, '\n');
+    }
+
+    std::ofstream traceFile(std::filesystem::path(tracePath), std::ios::binary | std::ios::out | std::ios::trunc);
+    traceFile.write(text.data(), static_cast<std::streamsize>(text.size()));
+    traceFile.close();
+    if (traceFile.fail())
+    {
+        AFERRLOG(L"AFilePackage::SaveAccessTrace(), Failed to write [{}]", tracePath);
+        return false;
+    }
+
+    return true;
+}
+
+bool AFilePackage::Repack(std::span<const std::wstring_view> tracePaths, AFPCK_COMPACTSTATS* outStats)
+{
+    // Entries of each phase in first-access order, phases in the order they first appear
+    std::vector<std::vector<std::uint32_t>> phaseEntries;
+    std::unordered_map<std::string, std::size_t> phaseIndices;
+    for (std::wstring_view tracePath : tracePaths)
+    {
+        std::ifstream traceFile(std::filesystem::path(tracePath), std::ios::binary);
+        if (!traceFile)
+        {
+            AFERRLOG(L"AFilePackage::Repack(), Can not open trace [{}]", tracePath);
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(traceFile, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+
+            const std::size_t phaseEnd = line.find('\t');
+            const std::size_t timeEnd = phaseEnd == std::string::npos ? std::string::npos : line.find('\t', phaseEnd + 1);
+            if (timeEnd == std::string::npos)
+            {
+                AFERRLOG(L"AFilePackage::Repack(), Malformed line in trace [{}]", tracePath);
+                return false;
+            }
+
+            const std::string_view name = std::string_view(line).substr(timeEnd + 1);
+            const int index = FindEntryIndex(TrimFileName(name));
+            if (index < 0)
+                continue;
+
+            auto [phase, added] = phaseIndices.try_emplace(line.substr(0, phaseEnd), phaseEntries.size());
+            if (added)
+                phaseEntries.emplace_back();
+
+            phaseEntries[phase->second].push_back(static_cast<std::uint32_t>(index));
+        }
+    }
+
+    // Compact() keeps the first position of an entry listed twice
+    std::vector<std::uint32_t> order;
+    for (const auto& entries : phaseEntries)
+        order.insert(order.end(), entries.begin(), entries.end());
+
+    return Compact(outStats, order);
+}
+
+bool AFilePackage::WritePayload(std::span<const std::byte> payload, AFPCK_ENTRYINFO& entry)
+{
+    const std::uint64_t length = payload.size();
+    const std::uint64_t offset = AllocateExtent(length);
+
+    bool written = FitsFormat(offset + length);
+    if (!written)
+        AFERRLOG(L"AFilePackage::WritePayload(), Package would exceed 4 GB; create it with AFPCK_CREATE_LARGE");
+    else
+    {
+        // A previous failed write must not fail this one as well
+        m_packageFile.clear();
+        m_packageFile.seekp(offset);
+        m_packageFile.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+        written = !m_packageFile.fail();
+        if (!written)
+            AFERRLOG(L"AFilePackage::WritePayload(), Failed to write {} bytes at {}", payload.size(), offset);
+    }
+
+    if (!written)
+    {
+        if (offset + length == m_appendOffset)
+            m_appendOffset = offset;
+        else
+            InsertFreeExtent(offset, length);
+
+        return false;
+    }
+
+    entry.dwOffset = offset;
+
+    return true;
+}
+
+std::uint64_t AFilePackage::AllocateExtent(std::uint64_t length)
+{
+    // Best fit: the smallest hole that is large enough; its tail stays free
+    auto fit = length > 0 ? m_freeBySize.lower_bound(length) : m_freeBySize.end();
+    if (fit == m_freeBySize.end())
+    {
+        const std::uint64_t offset = m_appendOffset;
+        m_appendOffset += length;
+        return offset;
+    }
+
+    const std::uint64_t holeLength = fit->first;
+    const std::uint64_t offset = fit->second;
+    m_freeBySize.erase(fit);
+    m_freeExtents.erase(offset);
+    m_freeBytes -= holeLength;
+
+    if (holeLength > length)
+    {
+        m_freeExtents.emplace(offset + length, holeLength - length);
+        m_freeBySize.emplace(holeLength - length, offset + length);
+        m_freeBytes += holeLength - length;
+    }
+
+    return offset;
+}
+
+void AFilePackage::ReleaseExtent(std::uint64_t offset, std::uint64_t length)
+{
+    // Released space stays reserved until a saved directory stops referencing it
+    if (length > 0 && !m_readOnly)
+        m_pendingFree.emplace_back(offset, length);
+}
+
+void AFilePackage::InsertFreeExtent(std::uint64_t offset, std::uint64_t length)
+{
+    if (length == 0)
+        return;
+
+    auto eraseBySize = [this](std::uint64_t extentOffset, std::uint64_t extentLength) {
+        auto range = m_freeBySize.equal_range(extentLength);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second == extentOffset)
+            {
+                m_freeBySize.erase(it);
+                break;
+            }
+        }
+    };
+
+    m_freeBytes += length;
+
+    // Merge with the neighbouring holes
+    auto next = m_freeExtents.lower_bound(offset);
+    if (next != m_freeExtents.begin())
+    {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset)
+        {
+            eraseBySize(prev->first, prev->second);
+            offset = prev->first;
+            length += prev->second;
+            m_freeExtents.erase(prev);
+        }
+    }
+
+    if (next != m_freeExtents.end() && offset + length == next->first)
+    {
+        eraseBySize(next->first, next->second);
+        length += next->second;
+        m_freeExtents.erase(next);
+    }
+
+    m_freeExtents.emplace(offset, length);
+    m_freeBySize.emplace(length, offset);
+}
+
+void AFilePackage::RebuildFreeExtents()
+{
+    m_freeExtents.clear();
+    m_freeBySize.clear();
+    m_pendingFree.clear();
+    m_freeBytes = 0;
+
+    if (m_readOnly)
+        return;
+
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> holes;
+    CollectHoles(holes);
+    for (const auto& [offset, length] : holes)
+        InsertFreeExtent(offset, length);
+}
+
+void AFilePackage::CollectHoles(std::vector<std::pair<std::uint64_t, std::uint64_t>>& outHoles) const
+{
+    // Holes are the gaps between live payloads and committed metadata
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> extents(m_metadataExtents);
+    extents.reserve(m_fileEntries.size() + m_metadataExtents.size() + 2);
+    for (const auto& entry : m_fileEntries)
+    {
+        if (entry.dwCompressedLength > 0)
+            extents.emplace_back(entry.dwOffset, entry.dwCompressedLength);
+    }
+
+    if (m_committedEnd > m_footerOffset)
+        extents.emplace_back(m_footerOffset, m_committedEnd - m_footerOffset);
+
+    if (m_packageId != 0)
+        extents.emplace_back(0, SIGNATURE_SIZE);
+
+    std::sort(extents.begin(), extents.end());
+
+    std::uint64_t cursor = 0;
+    for (const auto& [offset, length] : extents)
+    {
+        if (offset > cursor)
+            outHoles.emplace_back(cursor, offset - cursor);
+
+        cursor = std::max(cursor, offset + length);
+    }
+
+    if (m_appendOffset > cursor)
+        outHoles.emplace_back(cursor, m_appendOffset - cursor);
+}
+
+void AFilePackage::BuildPayloadRefs()
+{
+    if (m_payloadRefsBuilt)
+        return;
+
+    m_payloadRefs.clear();
+    m_payloadRefs.reserve(m_fileEntries.size());
+    for (const auto& entry : m_fileEntries)
+    {
+        if (entry.dwCompressedLength > 0)
+        {
+            PAYLOADREF& ref = m_payloadRefs[PayloadKey(entry)];
+            ref.compressedLength = entry.dwCompressedLength;
+            ++ref.count;
+        }
+    }
+
+    m_payloadRefsBuilt = true;
+}
+
+void AFilePackage::AddPayloadRef(const AFPCK_ENTRYINFO& entry)
+{
+    // Until built, the counts come from the directory, which already holds the entry
+    if (m_payloadRefsBuilt && entry.dwCompressedLength > 0)
+    {
+        PAYLOADREF& ref = m_payloadRefs[PayloadKey(entry)];
+        ref.compressedLength = entry.dwCompressedLength;
+        ++ref.count;
+    }
+}
+
+void AFilePackage::ReleasePayload(const AFPCK_ENTRYINFO& entry)
+{
+    if (entry.dwCompressedLength == 0)
+        return;
+
+    BuildPayloadRefs();
+    const std::uint64_t key = PayloadKey(entry);
+    auto refs = m_payloadRefs.find(key);
+    if (refs != m_payloadRefs.end())
+    {
+        if (--refs->second.count > 0)
+            return;
+
+        m_payloadRefs.erase(refs);
+    }
+
+    m_entryCache.Erase(key);
+    m_blockCache.Erase(key);
+    ReleaseExtent(entry.dwOffset, entry.dwCompressedLength);
+}
+
+bool AFilePackage::FindDuplicate(const AHASH128& contentHash, std::span<const std::byte> fileData, AFPCK_ENTRYINFO& outEntry)
+{
+    BuildPayloadRefs();
+    auto [it, last] = m_dedupPayloads.equal_range(contentHash);
+    while (it != last)
+    {
+        // A payload freed since it was recorded may have been reused for other data
+        const AFPCK_ENTRYINFO& candidate = it->second;
+        auto refs = m_payloadRefs.find(PayloadKey(candidate));
+        if (refs == m_payloadRefs.end() || refs->second.compressedLength != candidate.dwCompressedLength)
+        {
+            it = m_dedupPayloads.erase(it);
+            continue;
+        }
+
+        if (candidate.dwLength == fileData.size())
+        {
+            m_dedupBuffer.resize(fileData.size());
+            std::size_t bytesRead = 0;
+            if (ReadFile(candidate, m_dedupBuffer, 0, bytesRead) && bytesRead == fileData.size() &&
+                std::memcmp(m_dedupBuffer.data(), fileData.data(), fileData.size()) == 0)
+            {
+                outEntry = candidate;
+                return true;
+            }
+        }
+
+        ++m_dedupStats.hashCollisions;
+        ++it;
+    }
+
+    return false;
+}
+
+std::string AFilePackage::NormalizeFileName(std::wstring_view fileName)
+{
+    std::wstring file(fileName);
+    return ::NormalizeFileName(ASTR_UNICODE_TO_UTF8(file));
+}
+
+bool AFilePackage::FileNamesEqual(std::string_view a, std::string_view b) noexcept
+{
+    // Folds exactly what HashFileName() folds
+    auto fold = [](char ch) {
+        unsigned char c = static_cast<unsigned char>(ch);
+        if (c == '/')
+            return static_cast<unsigned char>('\\');
+        if (c >= 'A' && c <= 'Z')
+            return static_cast<unsigned char>(c - 'A' + 'a');
+        return c;
+    };
+
+    return a.size() == b.size() &&
+        std::equal(a.begin(), a.end(), b.begin(), [&fold](char ca, char cb) { return fold(ca) == fold(cb); });
+}
+
+bool AFilePackage::EncodeFileName(std::wstring_view fileName, std::span<char> buffer, std::string_view& outName) noexcept
+{
+    // NormalizeFileName() stops at an embedded null like the Win32 conversion does
+    fileName = fileName.substr(0, fileName.find(L'\0'));
+
+    std::size_t length = 0;
+    if (!AString_UnicodeToUTF8(fileName, buffer.data(), buffer.size(), length))
+        return false;
+
+    outName = TrimFileName(std::string_view(buffer.data(), length));
+
+    return true;
+}
+
+std::uint32_t AFilePackage::AddEntryName(std::string_view name)
+{
+    const auto offset = static_cast<std::uint32_t>(m_namePool.size());
+    m_namePool.insert(m_namePool.end(), name.begin(), name.end());
+    m_namePool.push_back('\0');
+
+    return offset;
+}
+
+void AFilePackage::CompactNamePool()
+{
+    std::vector<char> pool;
+    pool.reserve(m_namePool.size() - m_deadNameBytes);
+    for (auto& entry : m_fileEntries)
+    {
+        const auto offset = static_cast<std::uint32_t>(pool.size());
+        pool.insert(pool.end(), m_namePool.begin() + entry.dwNameOffset, m_namePool.begin() + entry.dwNameOffset + entry.dwNameLength + 1);
+        entry.dwNameOffset = offset;
+    }
+
+    m_namePool = std::move(pool);
+    m_deadNameBytes = 0;
+}
+
+void AFilePackage::ToFileEntry(const AFPCK_ENTRYINFO& info, AFPCK_FILEENTRY& outEntry) const
+{
+    const std::string_view name = GetEntryName(info);
+    std::copy(name.begin(), name.end(), outEntry.szFileName);
+    outEntry.szFileName[name.size()] = '\0';
+    outEntry.dwOffset = info.dwOffset;
+    outEntry.dwLength = info.dwLength;
+    outEntry.dwCompressedLength = info.dwCompressedLength;
+    outEntry.dwFlags = info.dwFlags;
+}
+
+void AFilePackage::RebuildIndex()
+{
+    std::vector<std::uint64_t> hashes(m_fileEntries.size());
+    for (std::size_t i = 0; i < m_fileEntries.size(); ++i)
+        hashes[i] = HashFileName(GetEntryName(m_fileEntries[i]));
+
+    BuildIndex(hashes);
+}
+
+void AFilePackage::BuildIndex(std::span<const std::uint64_t> hashes)
+{
+    // Keep the load factor at or below one half
+    std::size_t capacity = 16;
+    while (capacity < hashes.size() * 2)
+        capacity <<= 1;
+
+    m_index.assign(capacity, INDEXSLOT{ 0, EMPTY_SLOT });
+
+    // Insert grouped by the high bits of the home slot so the table fills front to back
+    // instead of taking a cache miss per entry
+    const std::size_t mask = capacity - 1;
+    int shift = 0;
+    while ((capacity >> shift) > INDEX_BUILD_BUCKETS)
+        ++shift;
+
+    std::vector<std::uint32_t> bucketStart((capacity >> shift) + 1, 0);
+    for (std::uint64_t hash : hashes)
+        ++bucketStart[((hash & mask) >> shift) + 1];
+
+    for (std::size_t b = 1; b < bucketStart.size(); ++b)
+        bucketStart[b] += bucketStart[b - 1];
+
+    std::vector<std::uint32_t> order(hashes.size());
+    for (std::size_t i = 0; i < hashes.size(); ++i)
+        order[bucketStart[(hashes[i] & mask) >> shift]++] = static_cast<std::uint32_t>(i);
+
+    for (std::uint32_t i : order)
+    {
+        std::size_t slot = static_cast<std::size_t>(hashes[i]) & mask;
+        while (m_index[slot].index != EMPTY_SLOT)
+            slot = (slot + 1) & mask;
+
+        m_index[slot] = INDEXSLOT{ hashes[i], i };
+    }
+}
+
+void AFilePackage::IndexInsert(std::uint64_t hash, std::uint32_t index)
+{
+    if (m_index.empty() || (m_fileEntries.size() * 2 > m_index.size()))
+    {
+        // RebuildIndex() already covers the entry being inserted
+        RebuildIndex();
+        return;
+    }
+
+    const std::size_t mask = m_index.size() - 1;
+    std::size_t slot = static_cast<std::size_t>(hash) & mask;
+    while (m_index[slot].index != EMPTY_SLOT)
+        slot = (slot + 1) & mask;
+
+    m_index[slot] = INDEXSLOT{ hash, index };
+}
+
+void AFilePackage::IndexErase(std::uint64_t hash, std::uint32_t index)
+{
+    const std::size_t mask = m_index.size() - 1;
+    std::size_t slot = static_cast<std::size_t>(hash) & mask;
+    while (m_index[slot].index != index)
+    {
+        if (m_index[slot].index == EMPTY_SLOT)
+            return;
+
+        slot = (slot + 1) & mask;
+    }
+
+    // Backward-shift deletion keeps probe chains intact without tombstones
+    std::size_t hole = slot;
+    for (std::size_t next = (hole + 1) & mask; m_index[next].index != EMPTY_SLOT; next = (next + 1) & mask)
+    {
+        const std::size_t home = static_cast<std::size_t>(m_index[next].hash) & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            m_index[hole] = m_index[next];
+            hole = next;
+        }
+    }
+
+    m_index[hole] = INDEXSLOT{ 0, EMPTY_SLOT };
+}
+
+void AFilePackage::IndexRelocate(std::uint64_t hash, std::uint32_t oldIndex, std::uint32_t newIndex)
+{
+    const std::size_t mask = m_index.size() - 1;
+    for (std::size_t slot = static_cast<std::size_t>(hash) & mask; m_index[slot].index != EMPTY_SLOT; slot = (slot + 1) & mask)
+    {
+        if (m_index[slot].index == oldIndex)
+        {
+            m_index[slot].index = newIndex;
+            return;
+        }
+    }
+}
+
+int AFilePackage::FindEntryIndex(std::string_view trimmedName) const
+{
+    if (m_index.empty())
+        return -1;
+
+    const std::uint64_t hash = HashFileName(trimmedName);
+    const std::size_t mask = m_index.size() - 1;
+    for (std::size_t slot = static_cast<std::size_t>(hash) & mask; m_index[slot].index != EMPTY_SLOT; slot = (slot + 1) & mask)
+    {
+        const INDEXSLOT& candidate = m_index[slot];
+        if (candidate.hash == hash && FileNamesEqual(GetEntryName(m_fileEntries[candidate.index]), trimmedName))
+            return static_cast<int>(candidate.index);
+    }
+
+    return -1;
+}
+
+int AFilePackage::FindEntryIndex(std::wstring_view fileName) const
+{
+    // Common names are encoded on the stack; only very long ones take the allocating path
+    char buffer[NAME_BUFFER_SIZE];
+    std::string_view name;
+    if (!EncodeFileName(fileName, buffer, name))
+        return FindEntryIndex(NormalizeFileName(fileName));
+
+    return FindEntryIndex(name);
+}
+
+int AFilePackage::FindEntryIndexByHash(std::uint64_t hash) const
+{
+    if (m_index.empty())
+        return -1;
+
+    // Probe on to the end of the run so that a colliding second name is noticed
+    int found = -1;
+    const std::size_t mask = m_index.size() - 1;
+    for (std::size_t slot = static_cast<std::size_t>(hash) & mask; m_index[slot].index != EMPTY_SLOT; slot = (slot + 1) & mask)
+    {
+        if (m_index[slot].hash != hash)
+            continue;
+
+        if (found >= 0)
+            return -1;
+
+        found = static_cast<int>(m_index[slot].index);
+    }
+
+    return found;
+}
+
+bool OpenFilePackage(std::wstring_view packFile)
+{
+    CloseFilePackage(); // ensure clean state
+
+    // Priority 0, patches mount above it. Read-only, so that AFileImage loads may run on several
+    // threads; positional reads stand in where the package can not be mapped.
+    AMountTable& mounts = GetGlobalMountTable();
+    if (!mounts.MountPackage(packFile, 0, AFPCK_OPEN_MAPPED) && !mounts.MountPackage(packFile, 0, AFPCK_OPEN_CONCURRENT))
+        return false;
+
+    g_globalPackagePath = packFile;
+
+    return true;
+}
+
+bool CloseFilePackage()
+{
+    if (g_globalPackagePath.empty())
+        return true;
+
+    const bool result = GetGlobalMountTable().Unmount(g_globalPackagePath);
+    g_globalPackagePath.clear();
+
+    return result;
+}
+
+const AFilePackage* GetGlobalFilePackage()
 {
-    return g_globalPackage.get();
+    return g_globalPackagePath.empty() ? nullptr : GetGlobalMountTable().GetPackage(g_globalPackagePath);
 }
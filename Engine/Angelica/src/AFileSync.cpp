@@ -0,0 +1,85 @@
+#include "pch.h"
+#include "AFileSync.h"
+#include "AFPI.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool AFile_SyncToDisk(std::wstring_view filePath)
+{
+    // Buffers are flushed per file, not per handle, so a second handle reaches the writer's data
+    std::wstring path(filePath);
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        AFERRLOG(L"AFile_SyncToDisk(), Can not open file [{}]", filePath);
+        return false;
+    }
+
+    const bool result = FlushFileBuffers(file) != FALSE;
+    CloseHandle(file);
+    if (!result)
+        AFERRLOG(L"AFile_SyncToDisk(), Failed to flush [{}]", filePath);
+
+    return result;
+}
+
+bool AFile_SyncDirectory(std::wstring_view directoryPath)
+{
+    return true;
+}
+
+#else
+
+bool AFile_SyncToDisk(std::wstring_view filePath)
+{
+    // fsync() writes back the file's dirty pages whichever descriptor wrote them
+    std::filesystem::path path(filePath);
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        AFERRLOG(L"AFile_SyncToDisk(), Can not open file [{}]", filePath);
+        return false;
+    }
+
+    int result = 0;
+    do
+        result = ::fsync(fd);
+    while (result != 0 && errno == EINTR);
+
+    ::close(fd);
+    if (result != 0)
+        AFERRLOG(L"AFile_SyncToDisk(), Failed to flush [{}]", filePath);
+
+    return result == 0;
+}
+
+bool AFile_SyncDirectory(std::wstring_view directoryPath)
+{
+    std::filesystem::path path(directoryPath.empty() ? std::wstring_view(L".") : directoryPath);
+    const int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        AFERRLOG(L"AFile_SyncDirectory(), Can not open directory [{}]", directoryPath);
+        return false;
+    }
+
+    int result = 0;
+    do
+        result = ::fsync(fd);
+    while (result != 0 && errno == EINTR);
+
+    ::close(fd);
+    if (result != 0)
+        AFERRLOG(L"AFile_SyncDirectory(), Failed to flush [{}]", directoryPath);
+
+    return result == 0;
+}
+
+#endif
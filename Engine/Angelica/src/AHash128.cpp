@@ -0,0 +1,88 @@
+#include "pch.h"
+#include "AHash128.h"
+
+#include <bit>
+#include <cstring>
+
+namespace
+{
+    constexpr std::uint64_t C1 = 0x87c37b91114253d5ull;
+    constexpr std::uint64_t C2 = 0x4cf5ad432745937full;
+
+    constexpr std::uint64_t Rotl(std::uint64_t value, int shift)
+    {
+        return (value << shift) | (value >> (64 - shift));
+    }
+
+    constexpr std::uint64_t Mix(std::uint64_t k)
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdull;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ull;
+        k ^= k >> 33;
+
+        return k;
+    }
+
+    // Little-endian regardless of the host, so the hash is the same everywhere
+    std::uint64_t LoadLE(const std::byte* data, std::size_t length)
+    {
+        std::uint64_t value = 0;
+        if constexpr (std::endian::native == std::endian::little)
+        {
+            std::memcpy(&value, data, length);
+            return value;
+        }
+
+        for (std::size_t i = 0; i < length; ++i)
+            value |= static_cast<std::uint64_t>(data[i]) << (8 * i);
+
+        return value;
+    }
+}
+
+AHASH128 AHash128(std::span<const std::byte> data, std::uint32_t seed) noexcept
+{
+    std::uint64_t h1 = seed;
+    std::uint64_t h2 = seed;
+
+    const std::size_t blockCount = data.size() / 16;
+    const std::byte* bytes = data.data();
+    for (std::size_t i = 0; i < blockCount; ++i, bytes += 16)
+    {
+        std::uint64_t k1 = LoadLE(bytes, 8);
+        std::uint64_t k2 = LoadLE(bytes + 8, 8);
+
+        k1 *= C1; k1 = Rotl(k1, 31); k1 *= C2; h1 ^= k1;
+        h1 = Rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= C2; k2 = Rotl(k2, 33); k2 *= C1; h2 ^= k2;
+        h2 = Rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    // Tail of up to 15 bytes
+    const std::size_t tail = data.size() & 15;
+    if (tail > 8)
+    {
+        std::uint64_t k2 = LoadLE(bytes + 8, tail - 8);
+        k2 *= C2; k2 = Rotl(k2, 33); k2 *= C1; h2 ^= k2;
+    }
+
+    if (tail > 0)
+    {
+        std::uint64_t k1 = LoadLE(bytes, std::min<std::size_t>(tail, 8));
+        k1 *= C1; k1 = Rotl(k1, 31); k1 *= C2; h1 ^= k1;
+    }
+
+    h1 ^= data.size();
+    h2 ^= data.size();
+    h1 += h2;
+    h2 += h1;
+    h1 = Mix(h1);
+    h2 = Mix(h2);
+    h1 += h2;
+    h2 += h1;
+
+    return AHASH128{ h1, h2 };
+}
@@ -0,0 +1,361 @@
+#include "pch.h"
+#include "ALZCodec.h"
+
+#include <bit>
+#include <limits>
+
+// Stream format, a sequence of:
+//   token      high nibble = literal count, low nibble = match length - MIN_MATCH (15 = more bytes follow)
+//   [lit ext]  255-continued extra literal count
+//   literals
+//   offset     16-bit little-endian match distance (absent in the final, literal-only sequence)
+//   [match ext] 255-continued extra match length
+// The last LAST_LITERALS bytes are always literals and no match starts in the last MATCH_GUARD
+// bytes, which lets the decoder copy in 8 and 16 byte chunks without per-byte bounds checks.
+// Chunked copies may write past the bytes they need as long as they stay inside dest; the
+// following sequences overwrite the excess.
+
+namespace
+{
+    constexpr std::size_t MIN_MATCH = 4;
+    constexpr std::size_t LAST_LITERALS = 5;
+    constexpr std::size_t MATCH_GUARD = 12;
+    constexpr std::size_t MAX_OFFSET = 0xFFFF;
+    constexpr int HASH_BITS = 16;
+    constexpr int MIN_SKIP_SHIFT = 6; // Level 1: step up one byte every 64 misses
+
+    // Match finder of Compress(), kept per thread. Entries hold t_hashBase + position + 1, so those at
+    // or below the base of the current call are stale; moving the base on empties the table without
+    // clearing it.
+    thread_local std::vector<std::uint32_t> t_hashTable;
+    thread_local std::uint32_t t_hashBase = 0;
+
+    inline std::uint32_t Read32(const std::uint8_t* p)
+    {
+        std::uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    inline std::uint64_t Read64(const std::uint8_t* p)
+    {
+        std::uint64_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    // Length of the common prefix of p and ref, up to limit; compared 8 bytes at a time
+    inline std::size_t CountMatch(const std::uint8_t* p, const std::uint8_t* ref, const std::uint8_t* limit)
+    {
+        const std::uint8_t* const start = p;
+        while (limit - p >= 8)
+        {
+            const std::uint64_t diff = Read64(p) ^ Read64(ref);
+            if (diff != 0)
+            {
+                if constexpr (std::endian::native == std::endian::little)
+                    return static_cast<std::size_t>(p - start) + (std::countr_zero(diff) >> 3);
+                else
+                    return static_cast<std::size_t>(p - start) + (std::countl_zero(diff) >> 3);
+            }
+
+            p += 8;
+            ref += 8;
+        }
+
+        while (p < limit && *p == *ref)
+        {
+            ++p;
+            ++ref;
+        }
+
+        return static_cast<std::size_t>(p - start);
+    }
+
+    // Copies [src, src + length) in 16-byte chunks, writing up to 15 bytes more
+    inline void WildCopy16(std::uint8_t* dst, const std::uint8_t* src, std::size_t length)
+    {
+        std::uint8_t* const end = dst + length;
+        do
+        {
+            std::memcpy(dst, src, 16);
+            dst += 16;
+            src += 16;
+        } while (dst < end);
+    }
+
+    // Repeats the offset-byte pattern behind op over [op, op + length), writing up to 7 bytes more.
+    // Short offsets are widened first so the rest can copy 8 bytes at a time, as LZ4 does.
+    inline void CopyMatch(std::uint8_t* op, const std::uint8_t* match, std::size_t offset, std::size_t length)
+    {
+        static constexpr std::uint8_t inc32[8] = { 0, 1, 2, 1, 0, 4, 4, 4 };
+        static constexpr std::int8_t dec64[8] = { 0, 0, 0, -1, -4, 1, 2, 3 };
+
+        std::uint8_t* const end = op + length;
+        if (offset < 8)
+        {
+            op[0] = match[0];
+            op[1] = match[1];
+            op[2] = match[2];
+            op[3] = match[3];
+            match += inc32[offset];
+            std::memcpy(op + 4, match, 4);
+            match -= dec64[offset];
+        }
+        else
+        {
+            std::memcpy(op, match, 8);
+            match += 8;
+        }
+
+        // From here on match is at least 8 bytes behind op
+        op += 8;
+        while (op < end)
+        {
+            std::memcpy(op, match, 8);
+            op += 8;
+            match += 8;
+        }
+    }
+
+    inline std::uint32_t HashSequence(std::uint32_t sequence)
+    {
+        return (sequence * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    // Writes a 255-continued length; returns false if it does not fit
+    inline bool WriteLength(std::uint8_t*& op, const std::uint8_t* oend, std::size_t length)
+    {
+        while (length >= 255)
+        {
+            if (op >= oend)
+                return false;
+
+            *op++ = 255;
+            length -= 255;
+        }
+
+        if (op >= oend)
+            return false;
+
+        *op++ = static_cast<std::uint8_t>(length);
+
+        return true;
+    }
+
+    inline bool ReadLength(const std::uint8_t*& ip, const std::uint8_t* iend, std::size_t& length)
+    {
+        std::uint8_t b;
+        do
+        {
+            if (ip >= iend)
+                return false;
+
+            b = *ip++;
+            length += b;
+        } while (b == 255);
+
+        return true;
+    }
+
+    bool EmitSequence(std::uint8_t*& op, const std::uint8_t* oend, const std::uint8_t* literals, std::size_t literalCount,
+        std::size_t offset, std::size_t matchLength)
+    {
+        if (op >= oend)
+            return false;
+
+        std::uint8_t* token = op++;
+        *token = static_cast<std::uint8_t>(std::min<std::size_t>(literalCount, 15) << 4);
+        if (literalCount >= 15 && !WriteLength(op, oend, literalCount - 15))
+            return false;
+
+        if (static_cast<std::size_t>(oend - op) < literalCount)
+            return false;
+
+        // A match and the last literals, at least 9 bytes, follow these literals in the source
+        if (matchLength != 0 && static_cast<std::size_t>(oend - op) >= literalCount + 8)
+        {
+            for (std::size_t i = 0; i < literalCount; i += 8)
+                std::memcpy(op + i, literals + i, 8);
+        }
+        else if (literalCount > 0)
+        {
+            std::memcpy(op, literals, literalCount);
+        }
+
+        op += literalCount;
+
+        // Final sequence carries literals only
+        if (matchLength == 0)
+            return true;
+
+        if (oend - op < 2)
+            return false;
+
+        *op++ = static_cast<std::uint8_t>(offset & 0xFF);
+        *op++ = static_cast<std::uint8_t>(offset >> 8);
+
+        const std::size_t matchCode = matchLength - MIN_MATCH;
+        *token |= static_cast<std::uint8_t>(std::min<std::size_t>(matchCode, 15));
+        if (matchCode >= 15 && !WriteLength(op, oend, matchCode - 15))
+            return false;
+
+        return true;
+    }
+}
+
+std::size_t ALZCodec::GetCompressBound(std::size_t sourceSize) const noexcept
+{
+    return sourceSize + sourceSize / 255 + 16;
+}
+
+std::size_t ALZCodec::Compress(std::span<const std::byte> source, std::span<std::byte> dest, int level) const
+{
+    const auto* src = reinterpret_cast<const std::uint8_t*>(source.data());
+    const std::size_t length = source.size();
+    std::uint8_t* op = reinterpret_cast<std::uint8_t*>(dest.data());
+    const std::uint8_t* oend = op + dest.size();
+
+    std::size_t anchor = 0;
+    if (length > MATCH_GUARD)
+    {
+        if (t_hashTable.empty() || length >= std::numeric_limits<std::uint32_t>::max() - t_hashBase)
+        {
+            t_hashTable.assign(std::size_t(1) << HASH_BITS, 0);
+            t_hashBase = 0;
+        }
+
+        std::uint32_t* const table = t_hashTable.data();
+        const std::uint32_t base = t_hashBase;
+        t_hashBase += static_cast<std::uint32_t>(length);
+
+        const std::size_t matchLimit = length - MATCH_GUARD;
+        const std::uint8_t* const extendLimit = src + length - LAST_LITERALS;
+        // Higher levels step through unmatched data more slowly and so find more matches
+        const int skipShift = MIN_SKIP_SHIFT - 1 + std::clamp(level, 1, 9);
+
+        std::size_t ip = 0;
+        while (ip < matchLimit)
+        {
+            const std::uint32_t sequence = Read32(src + ip);
+            const std::uint32_t hash = HashSequence(sequence);
+            const std::uint32_t candidate = table[hash];
+            table[hash] = base + static_cast<std::uint32_t>(ip + 1);
+
+            const std::size_t ref = candidate - base - 1;
+            if (candidate <= base || ip - ref > MAX_OFFSET || Read32(src + ref) != sequence)
+            {
+                // Skip faster through data that does not match
+                ip += 1 + ((ip - anchor) >> skipShift);
+                continue;
+            }
+
+            const std::size_t matchLength = MIN_MATCH + CountMatch(src + ip + MIN_MATCH, src + ref + MIN_MATCH, extendLimit);
+            if (!EmitSequence(op, oend, src + anchor, ip - anchor, ip - ref, matchLength))
+                return 0;
+
+            ip += matchLength;
+            anchor = ip;
+
+            // Seed the table inside the match so the next search has nearby candidates
+            if (ip - 2 < matchLimit)
+                table[HashSequence(Read32(src + ip - 2))] = base + static_cast<std::uint32_t>(ip - 2 + 1);
+        }
+    }
+
+    if (!EmitSequence(op, oend, src + anchor, length - anchor, 0, 0))
+        return 0;
+
+    return static_cast<std::size_t>(op - reinterpret_cast<std::uint8_t*>(dest.data()));
+}
+
+bool ALZCodec::Decompress(std::span<const std::byte> source, std::span<std::byte> dest) const
+{
+    const auto* ip = reinterpret_cast<const std::uint8_t*>(source.data());
+    const std::uint8_t* iend = ip + source.size();
+    auto* const ostart = reinterpret_cast<std::uint8_t*>(dest.data());
+    std::uint8_t* op = ostart;
+    const std::uint8_t* oend = ostart + dest.size();
+
+    while (ip < iend)
+    {
+        const std::uint8_t token = *ip++;
+        std::size_t literalCount = token >> 4;
+
+        // Fast path for the common short sequence far from both ends: at most 14 literals and an
+        // 18-byte match at an offset of 8 or more, copied in fixed-size chunks
+        if (literalCount < 15 && (token & 15) < 15 && iend - ip >= 16 + 2 && oend - op >= 16 + 18)
+        {
+            std::memcpy(op, ip, 16);
+            op += literalCount;
+            ip += literalCount;
+
+            const std::size_t offset = static_cast<std::size_t>(ip[0]) | (static_cast<std::size_t>(ip[1]) << 8);
+            const std::size_t matchLength = (token & 15) + MIN_MATCH;
+            if (offset >= 8 && offset <= static_cast<std::size_t>(op - ostart))
+            {
+                ip += 2;
+                const std::uint8_t* match = op - offset;
+                std::memcpy(op, match, 8);
+                std::memcpy(op + 8, match + 8, 8);
+                std::memcpy(op + 16, match + 16, 2);
+                op += matchLength;
+                continue;
+            }
+
+            // Short or invalid offset: the literals are done, the match takes the general path
+            literalCount = 0;
+        }
+        else
+        {
+            if (literalCount == 15 && !ReadLength(ip, iend, literalCount))
+                return false;
+
+            if (literalCount > static_cast<std::size_t>(iend - ip) || literalCount > static_cast<std::size_t>(oend - op))
+                return false;
+
+            const std::size_t chunkedLength = std::max<std::size_t>(16, (literalCount + 15) & ~std::size_t(15));
+            if (static_cast<std::size_t>(iend - ip) >= chunkedLength && static_cast<std::size_t>(oend - op) >= chunkedLength)
+                WildCopy16(op, ip, literalCount);
+            else if (literalCount > 0)
+                std::memcpy(op, ip, literalCount);
+
+            op += literalCount;
+            ip += literalCount;
+
+            if (ip == iend)
+                break;
+        }
+
+        if (iend - ip < 2)
+            return false;
+
+        const std::size_t offset = static_cast<std::size_t>(ip[0]) | (static_cast<std::size_t>(ip[1]) << 8);
+        ip += 2;
+        if (offset == 0 || offset > static_cast<std::size_t>(op - ostart))
+            return false;
+
+        std::size_t matchLength = token & 15;
+        if (matchLength == 15 && !ReadLength(ip, iend, matchLength))
+            return false;
+
+        matchLength += MIN_MATCH;
+        if (matchLength > static_cast<std::size_t>(oend - op))
+            return false;
+
+        const std::uint8_t* match = op - offset;
+        if (static_cast<std::size_t>(oend - op) >= matchLength + 8)
+        {
+            CopyMatch(op, match, offset, matchLength);
+        }
+        else
+        {
+            for (std::size_t i = 0; i < matchLength; ++i)
+                op[i] = match[i];
+        }
+
+        op += matchLength;
+    }
+
+    return op == oend;
+}
@@ -0,0 +1,375 @@
+#include "pch.h"
+#include "AMountTable.h"
+#include "AFPI.h"
+
+#include <mutex>
+
+namespace
+{
+    AEntryBuffer ReadDiskFile(const std::wstring& path)
+    {
+        std::ifstream file(std::filesystem::path(path), std::ios::binary);
+        if (!file)
+        {
+            AFERRLOG(L"AMountTable::ReadFile(), Can not open file [{}]", path);
+            return nullptr;
+        }
+
+        file.seekg(0, std::ios::end);
+        const auto fileSize = static_cast<std::size_t>(file.tellg());
+        file.seekg(0, std::ios::beg);
+
+        auto buffer = std::make_shared<std::vector<std::byte>>(fileSize);
+        file.read(reinterpret_cast<char*>(buffer->data()), static_cast<std::streamsize>(fileSize));
+        if (file.gcount() != static_cast<std::streamsize>(fileSize))
+        {
+            AFERRLOG(L"AMountTable::ReadFile(), Failed to read file [{}]", path);
+            return nullptr;
+        }
+
+        return buffer;
+    }
+}
+
+AMountTable::~AMountTable()
+{
+    UnmountAll();
+}
+
+bool AMountTable::MountPackage(std::wstring_view pckPath, int priority, std::uint32_t openFlags)
+{
+    auto mount = std::make_unique<MOUNT>();
+    mount->path = pckPath;
+    mount->priority = priority;
+    mount->package = std::make_unique<AFilePackage>();
+    if (!mount->package->Open(pckPath, AFPCK_OPENEXIST, openFlags))
+    {
+        AFERRLOG(L"AMountTable::MountPackage(), Can not open package [{}]", pckPath);
+        return false;
+    }
+
+    return AddMount(std::move(mount));
+}
+
+bool AMountTable::MountDirectory(std::wstring_view dirPath, int priority)
+{
+    const std::filesystem::path root(dirPath);
+    std::error_code error;
+    if (!std::filesystem::is_directory(root, error))
+    {
+        AFERRLOG(L"AMountTable::MountDirectory(), [{}] is not a directory", dirPath);
+        return false;
+    }
+
+    auto mount = std::make_unique<MOUNT>();
+    mount->path = dirPath;
+    mount->priority = priority;
+
+    // Snapshot of the tree; files added later need a remount
+    std::filesystem::recursive_directory_iterator it(root, std::filesystem::directory_options::skip_permission_denied, error);
+    for (; !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error))
+    {
+        if (!it->is_regular_file(error))
+            continue;
+
+        mount->names.push_back(AFilePackage::NormalizeFileName(it->path().lexically_relative(root).wstring()));
+        mount->diskPaths.push_back(it->path().wstring());
+    }
+
+    if (error)
+    {
+        AFERRLOG(L"AMountTable::MountDirectory(), Failed to scan [{}]", dirPath);
+        return false;
+    }
+
+    return AddMount(std::move(mount));
+}
+
+bool AMountTable::Unmount(std::wstring_view path)
+{
+    std::unique_lock lock(m_mutex);
+    auto it = std::find_if(m_mounts.begin(), m_mounts.end(),
+        [path](const std::unique_ptr<MOUNT>& mount) { return mount->path == path; });
+    if (it == m_mounts.end())
+    {
+        AFERRLOG(L"AMountTable::Unmount(), [{}] is not mounted", path);
+        return false;
+    }
+
+    const bool result = !(*it)->package || (*it)->package->Close();
+    m_mounts.erase(it);
+    RebuildIndex();
+
+    return result;
+}
+
+void AMountTable::UnmountAll()
+{
+    std::unique_lock lock(m_mutex);
+    for (auto& mount : m_mounts)
+    {
+        if (mount->package)
+            mount->package->Close();
+    }
+
+    m_mounts.clear();
+    m_index.clear();
+    m_nameCount = 0;
+}
+
+bool AMountTable::Find(std::wstring_view fileName, AMOUNT_LOOKUP& outLookup) const
+{
+    // Encoded on the stack; only names that do not fit take the allocating path
+    char buffer[AFilePackage::NAME_BUFFER_SIZE];
+    std::string normalized;
+    std::string_view name;
+    if (!AFilePackage::EncodeFileName(fileName, buffer, name))
+    {
+        normalized = AFilePackage::NormalizeFileName(fileName);
+        name = normalized;
+    }
+
+    std::shared_lock lock(m_mutex);
+    const SLOT* slot = FindSlot(name);
+    return slot && FillLookup(*slot, outLookup);
+}
+
+bool AMountTable::Find(AAssetId id, AMOUNT_LOOKUP& outLookup) const
+{
+    std::shared_lock lock(m_mutex);
+    const SLOT* slot = FindSlotByHash(id.hash);
+    return slot && FillLookup(*slot, outLookup);
+}
+
+AEntryBuffer AMountTable::ReadFile(std::wstring_view fileName, bool* outFound) const
+{
+    // Encoded on the stack; only names that do not fit take the allocating path
+    char buffer[AFilePackage::NAME_BUFFER_SIZE];
+    std::string normalized;
+    std::string_view name;
+    if (!AFilePackage::EncodeFileName(fileName, buffer, name))
+    {
+        normalized = AFilePackage::NormalizeFileName(fileName);
+        name = normalized;
+    }
+
+    // Held through the read so the source can not be unmounted underneath it
+    std::shared_lock lock(m_mutex);
+    const SLOT* slot = FindSlot(name);
+    if (outFound)
+        *outFound = slot != nullptr;
+
+    return slot ? ReadSlot(*slot) : nullptr;
+}
+
+AEntryBuffer AMountTable::ReadFile(AAssetId id) const
+{
+    std::shared_lock lock(m_mutex);
+    const SLOT* slot = FindSlotByHash(id.hash);
+    return slot ? ReadSlot(*slot) : nullptr;
+}
+
+AFilePackage* AMountTable::GetPackage(std::wstring_view pckPath) const
+{
+    std::shared_lock lock(m_mutex);
+    for (const auto& mount : m_mounts)
+    {
+        if (mount->package && mount->path == pckPath)
+            return mount->package.get();
+    }
+
+    return nullptr;
+}
+
+std::size_t AMountTable::GetMountCount() const
+{
+    std::shared_lock lock(m_mutex);
+    return m_mounts.size();
+}
+
+std::size_t AMountTable::GetFileCount() const
+{
+    std::shared_lock lock(m_mutex);
+    return m_nameCount;
+}
+
+bool AMountTable::AddMount(std::unique_ptr<MOUNT> mount)
+{
+    std::unique_lock lock(m_mutex);
+    for (const auto& existing : m_mounts)
+    {
+        if (existing->path == mount->path)
+        {
+            AFERRLOG(L"AMountTable::AddMount(), [{}] is already mounted", mount->path);
+            return false;
+        }
+    }
+
+    mount->sequence = m_nextSequence++;
+    m_mounts.push_back(std::move(mount));
+    MergeMount(static_cast<std::uint32_t>(m_mounts.size() - 1));
+
+    return true;
+}
+
+void AMountTable::MergeMount(std::uint32_t mountIndex)
+{
+    const MOUNT& mount = *m_mounts[mountIndex];
+    const std::size_t itemCount = mount.package ? mount.package->GetFileNumber() : mount.names.size();
+    Reserve(m_nameCount + itemCount);
+
+    // Each slot keeps the best source seen so far, so mounts can be merged in any order
+    const std::size_t mask = m_index.size() - 1;
+    for (std::uint32_t item = 0; item < itemCount; ++item)
+    {
+        const std::string_view name = GetItemName(mount, item);
+        const std::uint64_t hash = AFilePackage::HashFileName(name);
+        std::size_t slot = static_cast<std::size_t>(hash) & mask;
+        for (; m_index[slot].mount != EMPTY_SLOT; slot = (slot + 1) & mask)
+        {
+            SLOT& existing = m_index[slot];
+            if (existing.hash == hash && AFilePackage::FileNamesEqual(GetItemName(*m_mounts[existing.mount], existing.item), name))
+                break;
+        }
+
+        SLOT& target = m_index[slot];
+        if (target.mount == EMPTY_SLOT)
+        {
+            target = SLOT{ hash, mountIndex, item };
+            ++m_nameCount;
+        }
+        else if (Outranks(mount, *m_mounts[target.mount]))
+        {
+            target.mount = mountIndex;
+            target.item = item;
+        }
+    }
+}
+
+void AMountTable::RebuildIndex()
+{
+    m_index.clear();
+    m_nameCount = 0;
+    for (std::uint32_t i = 0; i < m_mounts.size(); ++i)
+        MergeMount(i);
+}
+
+void AMountTable::Reserve(std::size_t nameCount)
+{
+    // Keep the load factor at or below one half
+    std::size_t capacity = 16;
+    while (capacity < nameCount * 2)
+        capacity <<= 1;
+
+    if (capacity <= m_index.size())
+        return;
+
+    std::vector<SLOT> index(capacity, SLOT{ 0, EMPTY_SLOT, 0 });
+    const std::size_t mask = capacity - 1;
+    for (const SLOT& slot : m_index)
+    {
+        if (slot.mount == EMPTY_SLOT)
+            continue;
+
+        std::size_t target = static_cast<std::size_t>(slot.hash) & mask;
+        while (index[target].mount != EMPTY_SLOT)
+            target = (target + 1) & mask;
+
+        index[target] = slot;
+    }
+
+    m_index = std::move(index);
+}
+
+std::string_view AMountTable::GetItemName(const MOUNT& mount, std::uint32_t item) const
+{
+    // A package modified while mounted may have lost the entry; its slot then matches nothing
+    if (mount.package)
+    {
+        const AFPCK_ENTRYINFO* entry = mount.package->GetEntryByIndex(item);
+        return entry ? mount.package->GetEntryName(*entry) : std::string_view();
+    }
+
+    return mount.names[item];
+}
+
+bool AMountTable::Outranks(const MOUNT& a, const MOUNT& b) const noexcept
+{
+    return a.priority != b.priority ? a.priority > b.priority : a.sequence > b.sequence;
+}
+
+const AMountTable::SLOT* AMountTable::FindSlot(std::string_view trimmedName) const
+{
+    if (m_index.empty())
+        return nullptr;
+
+    const std::uint64_t hash = AFilePackage::HashFileName(trimmedName);
+    const std::size_t mask = m_index.size() - 1;
+    for (std::size_t slot = static_cast<std::size_t>(hash) & mask; m_index[slot].mount != EMPTY_SLOT; slot = (slot + 1) & mask)
+    {
+        const SLOT& candidate = m_index[slot];
+        if (candidate.hash == hash && AFilePackage::FileNamesEqual(GetItemName(*m_mounts[candidate.mount], candidate.item), trimmedName))
+            return &candidate;
+    }
+
+    return nullptr;
+}
+
+const AMountTable::SLOT* AMountTable::FindSlotByHash(std::uint64_t hash) const
+{
+    if (m_index.empty())
+        return nullptr;
+
+    // Probe on to the end of the run so that a colliding second name is noticed
+    const SLOT* found = nullptr;
+    const std::size_t mask = m_index.size() - 1;
+    for (std::size_t slot = static_cast<std::size_t>(hash) & mask; m_index[slot].mount != EMPTY_SLOT; slot = (slot + 1) & mask)
+    {
+        if (m_index[slot].hash != hash)
+            continue;
+
+        if (found)
+            return nullptr;
+
+        found = &m_index[slot];
+    }
+
+    return found;
+}
+
+bool AMountTable::FillLookup(const SLOT& slot, AMOUNT_LOOKUP& outLookup) const
+{
+    const MOUNT& mount = *m_mounts[slot.mount];
+    const AFPCK_ENTRYINFO* entry = mount.package ? mount.package->GetEntryByIndex(slot.item) : nullptr;
+    if (mount.package && !entry)
+        return false;
+
+    outLookup.package = mount.package.get();
+    outLookup.entry = entry;
+    outLookup.diskPath = mount.package ? std::wstring() : mount.diskPaths[slot.item];
+    outLookup.priority = mount.priority;
+
+    return true;
+}
+
+AEntryBuffer AMountTable::ReadSlot(const SLOT& slot) const
+{
+    const MOUNT& mount = *m_mounts[slot.mount];
+    if (!mount.package)
+        return ReadDiskFile(mount.diskPaths[slot.item]);
+
+    const AFPCK_ENTRYINFO* entry = mount.package->GetEntryByIndex(slot.item);
+    if (!entry)
+    {
+        AFERRLOG(L"AMountTable::ReadFile(), Entry {} of [{}] is gone; the package was modified while mounted", slot.item, mount.path);
+        return nullptr;
+    }
+
+    return mount.package->ReadFileShared(*entry);
+}
+
+AMountTable& GetGlobalMountTable()
+{
+    static AMountTable table;
+    return table;
+}
@@ -0,0 +1,140 @@
+#include "pch.h"
+#include "APositionalFile.h"
+#include "AFPI.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+APositionalFile::~APositionalFile()
+{
+    Close();
+}
+
+#ifdef _WIN32
+
+bool APositionalFile::Open(std::wstring_view filePath)
+{
+    Close();
+
+    std::wstring path(filePath);
+    m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        AFERRLOG(L"APositionalFile::Open(), Can not open file [{}]", filePath);
+        return false;
+    }
+
+    LARGE_INTEGER fileSize{};
+    if (!GetFileSizeEx(m_file, &fileSize))
+    {
+        AFERRLOG(L"APositionalFile::Open(), Can not get size of [{}]", filePath);
+        Close();
+        return false;
+    }
+
+    m_size = static_cast<std::uint64_t>(fileSize.QuadPart);
+
+    return true;
+}
+
+void APositionalFile::Close()
+{
+    if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+
+    m_file = INVALID_HANDLE_VALUE;
+    m_size = 0;
+}
+
+bool APositionalFile::ReadAt(std::uint64_t offset, std::span<std::byte> buffer) const
+{
+    std::size_t done = 0;
+    while (done < buffer.size())
+    {
+        // The offset travels with the request, so the handle's own file pointer is irrelevant
+        OVERLAPPED ov{};
+        const std::uint64_t pos = offset + done;
+        ov.Offset = static_cast<DWORD>(pos & 0xFFFFFFFFu);
+        ov.OffsetHigh = static_cast<DWORD>(pos >> 32);
+
+        const DWORD chunk = static_cast<DWORD>(std::min<std::size_t>(buffer.size() - done, 0x40000000u));
+        DWORD got = 0;
+        if (!::ReadFile(m_file, buffer.data() + done, chunk, &got, &ov) || got == 0)
+            return false;
+
+        done += got;
+    }
+
+    return true;
+}
+
+bool APositionalFile::IsOpen() const noexcept
+{
+    return m_file != INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool APositionalFile::Open(std::wstring_view filePath)
+{
+    Close();
+
+    std::filesystem::path path(filePath);
+    m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0)
+    {
+        AFERRLOG(L"APositionalFile::Open(), Can not open file [{}]", filePath);
+        return false;
+    }
+
+    struct stat st{};
+    if (::fstat(m_fd, &st) != 0)
+    {
+        AFERRLOG(L"APositionalFile::Open(), Can not get size of [{}]", filePath);
+        Close();
+        return false;
+    }
+
+    m_size = static_cast<std::uint64_t>(st.st_size);
+
+    return true;
+}
+
+void APositionalFile::Close()
+{
+    if (m_fd >= 0)
+        ::close(m_fd);
+
+    m_fd = -1;
+    m_size = 0;
+}
+
+bool APositionalFile::ReadAt(std::uint64_t offset, std::span<std::byte> buffer) const
+{
+    std::size_t done = 0;
+    while (done < buffer.size())
+    {
+        ssize_t got = ::pread(m_fd, buffer.data() + done, buffer.size() - done, static_cast<off_t>(offset + done));
+        if (got < 0 && errno == EINTR)
+            continue;
+
+        if (got <= 0)
+            return false;
+
+        done += static_cast<std::size_t>(got);
+    }
+
+    return true;
+}
+
+bool APositionalFile::IsOpen() const noexcept
+{
+    return m_fd >= 0;
+}
+
+#endif
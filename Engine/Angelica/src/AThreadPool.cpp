@@ -0,0 +1,55 @@
+#include "pch.h"
+#include "AThreadPool.h"
+
+AThreadPool::AThreadPool(unsigned int threadCount)
+{
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    m_threads.reserve(threadCount);
+    for (unsigned int i = 0; i < threadCount; ++i)
+        m_threads.emplace_back(&AThreadPool::WorkerLoop, this);
+}
+
+AThreadPool::~AThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+
+    m_wakeup.notify_all();
+
+    // Workers drain the queue before they exit
+    for (auto& thread : m_threads)
+        thread.join();
+}
+
+void AThreadPool::Enqueue(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+
+    m_wakeup.notify_one();
+}
+
+void AThreadPool::WorkerLoop()
+{
+    for (;;)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeup.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+            if (m_tasks.empty())
+                return;
+
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+
+        task();
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef _ATESTCOMMON_H_
+#define _ATESTCOMMON_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Commands of AngelicaTest; args are the arguments after the command name. Each returns the process
+// exit code, 0 when every check passed.
+using ATEST_COMMAND = int (*)(std::span<const std::wstring_view> args);
+
+int ATest_Package(std::span<const std::wstring_view> args);
+int ABench_MappedRead(std::span<const std::wstring_view> args);
+int ABench_LZCodec(std::span<const std::wstring_view> args);
+int ABench_Open(std::span<const std::wstring_view> args);
+int ABench_LargePackage(std::span<const std::wstring_view> args);
+int ABench_ColdLoad(std::span<const std::wstring_view> args);
+
+// Counts a failed check and reports it with its location; returns condition
+bool ATest_Check(bool condition, const char* expression, const char* file, int line);
+#define ATEST_CHECK(expr) ATest_Check(static_cast<bool>(expr), #expr, __FILE__, __LINE__)
+int ATest_GetFailureCount();
+
+// Scratch files live in <temp>/AngelicaTest, or in the directory given with --dir
+void ATest_SetWorkDir(std::wstring_view workDir);
+std::wstring ATest_GetWorkPath(std::wstring_view fileName);
+// Removes a package together with its .idx sidecar and any temporary left by Compact()
+void ATest_RemovePackage(const std::wstring& packagePath);
+
+// Reproducible test data: text-like bytes that compress about 3:1, or random bytes that do not
+std::vector<std::byte> ATest_MakeData(std::size_t length, std::uint32_t seed, bool compressible);
+
+// Value of "--name value" in args, or defaultValue
+std::size_t ATest_GetOption(std::span<const std::wstring_view> args, std::wstring_view name, std::size_t defaultValue);
+
+class ATestTimer
+{
+public:
+	ATestTimer() : m_start(std::chrono::steady_clock::now()) {}
+
+	void Restart() { m_start = std::chrono::steady_clock::now(); }
+	[[nodiscard]] double GetSeconds() const { return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count(); }
+
+private:
+	std::chrono::steady_clock::time_point m_start;
+};
+
+inline double ATest_MBPerSecond(std::uint64_t bytes, double seconds)
+{
+	return seconds > 0.0 ? static_cast<double>(bytes) / (1024.0 * 1024.0) / seconds : 0.0;
+}
+
+#endif
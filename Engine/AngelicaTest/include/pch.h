@@ -0,0 +1,29 @@
+#ifndef __ANGELICATEST_PRECOMPILED_HEADERS_H__
+#define __ANGELICATEST_PRECOMPILED_HEADERS_H__
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <Windows.h>
+
+// C++ Standard Library, as the Angelica headers expect it from the engine's pch.h
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#endif
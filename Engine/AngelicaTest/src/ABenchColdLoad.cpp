@@ -0,0 +1,247 @@
+#include "pch.h"
+
+#include <random>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "ACompressionPolicy.h"
+#include "AFilePackage.h"
+#include "ATestCommon.h"
+
+// Cold-cache load time before and after Repack(): a package of stored entries appended in random
+// order, two traced sessions that each load boot plus one zone, then a replay of all three load
+// phases with the package dropped from the OS file cache before every pass. Median of the passes.
+
+namespace
+{
+    constexpr std::size_t ENTRY_COUNT = 4000;
+    constexpr std::size_t READS_PER_PHASE = 700;
+    constexpr const char* PHASE_NAMES[3] = { "boot", "zone_forest", "zone_desert" };
+
+    std::wstring EntryName(std::size_t index)
+    {
+        return L"assets\\a" + std::to_wstring(index) + L".dds";
+    }
+
+    // Texture payloads arrive compressed already; stored entries keep the layout the only variable
+    const AAdaptiveCompressionPolicy& GetStorePolicy()
+    {
+        static const AAdaptiveCompressionPolicy policy = []() {
+            AAdaptiveCompressionPolicy storeDds;
+            storeDds.SetExtensionRule("dds", ACOMPRESSIONRULE{ ACOMPRESSION_STORE });
+            return storeDds;
+        }();
+
+        return policy;
+    }
+
+    // Writes back and evicts the file's cached pages so the next reads go to the disk
+    bool DropFileCache(const std::wstring& filePath)
+    {
+#ifdef _WIN32
+        // Opening without buffering purges the cache map of a file no other handle holds open
+        HANDLE file = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        CloseHandle(file);
+        return true;
+#else
+        std::filesystem::path path(filePath);
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        const bool dropped = ::fdatasync(fd) == 0 && ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+        ::close(fd);
+        return dropped;
+#endif
+    }
+
+    struct LOADRESULT
+    {
+        double seconds = 0.0;
+        std::size_t seekCount = 0; // Reads that do not start where the previous one ended
+    };
+
+    class ColdLoadBench
+    {
+    public:
+        explicit ColdLoadBench(std::wstring packagePath) : m_packagePath(std::move(packagePath)) {}
+
+        bool CreatePackage()
+        {
+            ATest_RemovePackage(m_packagePath);
+
+            std::mt19937 rng(22);
+            m_sizes.resize(ENTRY_COUNT);
+            for (std::size_t& size : m_sizes)
+                size = 16384 + rng() % (256 * 1024);
+
+            for (std::vector<std::size_t>& reads : m_phases)
+            {
+                for (std::size_t i = 0; i < READS_PER_PHASE; ++i)
+                    reads.push_back(rng() % ENTRY_COUNT);
+            }
+
+            std::vector<std::size_t> appendOrder(ENTRY_COUNT);
+            for (std::size_t i = 0; i < ENTRY_COUNT; ++i)
+                appendOrder[i] = i;
+
+            std::shuffle(appendOrder.begin(), appendOrder.end(), rng);
+
+            AFilePackage package;
+            if (!package.Open(m_packagePath, AFPCK_CREATENEW))
+                return false;
+
+            package.SetCompressionPolicy(&GetStorePolicy());
+            for (std::size_t index : appendOrder)
+            {
+                if (!package.AppendFile(EntryName(index), MakeContent(index)))
+                    return false;
+            }
+
+            return package.Close();
+        }
+
+        // Replays the phases in the given order, recording a trace of them when tracePath is set
+        LOADRESULT Load(std::span<const std::size_t> phaseOrder, const std::wstring& tracePath = {})
+        {
+            LOADRESULT result;
+            AFilePackage package;
+            if (!ATEST_CHECK(package.Open(m_packagePath, AFPCK_OPENEXIST, AFPCK_OPEN_CONCURRENT)))
+                return result;
+
+            if (!tracePath.empty())
+                package.StartAccessTrace();
+
+            std::vector<std::byte> buffer;
+            std::uint64_t previousEnd = 0;
+            bool readAll = true;
+            ATestTimer timer;
+            for (std::size_t phase : phaseOrder)
+            {
+                if (!tracePath.empty())
+                    package.SetAccessTracePhase(PHASE_NAMES[phase]);
+
+                for (std::size_t index : m_phases[phase])
+                {
+                    const AFPCK_ENTRYINFO* entry = package.FindFile(EntryName(index));
+                    if (entry == nullptr)
+                    {
+                        readAll = false;
+                        continue;
+                    }
+
+                    if (entry->dwOffset != previousEnd)
+                        ++result.seekCount;
+
+                    previousEnd = entry->dwOffset + entry->dwCompressedLength;
+                    buffer.resize(entry->dwLength);
+                    std::size_t bytesRead = 0;
+                    readAll &= package.ReadFile(*entry, buffer, 0, bytesRead) && bytesRead == m_sizes[index];
+                }
+            }
+
+            result.seconds = timer.GetSeconds();
+            ATEST_CHECK(readAll);
+            if (!tracePath.empty())
+                ATEST_CHECK(package.SaveAccessTrace(tracePath));
+
+            return result;
+        }
+
+        // Median of cold replays of every phase
+        LOADRESULT MeasureColdLoad(std::size_t passCount)
+        {
+            static constexpr std::size_t allPhases[3] = { 0, 1, 2 };
+            std::vector<LOADRESULT> passes;
+            for (std::size_t pass = 0; pass < passCount; ++pass)
+            {
+                if (!ATEST_CHECK(DropFileCache(m_packagePath)))
+                    break;
+
+                passes.push_back(Load(allPhases));
+            }
+
+            if (passes.empty())
+                return {};
+
+            std::sort(passes.begin(), passes.end(), [](const LOADRESULT& a, const LOADRESULT& b) { return a.seconds < b.seconds; });
+            return passes[passes.size() / 2];
+        }
+
+        // Every entry, not only the traced ones, must survive the repack unchanged
+        bool VerifyAll() const
+        {
+            AFilePackage package;
+            if (!package.Open(m_packagePath, AFPCK_OPENEXIST) || package.GetFileNumber() != ENTRY_COUNT)
+                return false;
+
+            std::vector<std::byte> buffer;
+            for (std::size_t index = 0; index < ENTRY_COUNT; ++index)
+            {
+                const AFPCK_ENTRYINFO* entry = package.FindFile(EntryName(index));
+                if (entry == nullptr)
+                    return false;
+
+                buffer.resize(entry->dwLength);
+                std::size_t bytesRead = 0;
+                if (!package.ReadFile(*entry, buffer, 0, bytesRead) || buffer != MakeContent(index))
+                    return false;
+            }
+
+            return true;
+        }
+
+    private:
+        std::vector<std::byte> MakeContent(std::size_t index) const
+        {
+            return ATest_MakeData(m_sizes[index], static_cast<std::uint32_t>(index), false);
+        }
+
+        std::wstring m_packagePath;
+        std::vector<std::size_t> m_sizes;
+        std::vector<std::size_t> m_phases[3]; // Entry indices each load phase reads, in order
+    };
+}
+
+int ABench_ColdLoad(std::span<const std::wstring_view> args)
+{
+    const std::size_t passCount = ATest_GetOption(args, L"--passes", 3);
+    const std::wstring packagePath = ATest_GetWorkPath(L"bench_coldload.pck");
+    const std::wstring tracePaths[2] = { ATest_GetWorkPath(L"bench_coldload_1.trace"), ATest_GetWorkPath(L"bench_coldload_2.trace") };
+
+    ColdLoadBench bench(packagePath);
+    if (!ATEST_CHECK(bench.CreatePackage()))
+        return 1;
+
+    // Two play sessions: boot then the forest, boot then the desert
+    static constexpr std::size_t session1[2] = { 0, 1 };
+    static constexpr std::size_t session2[2] = { 0, 2 };
+    bench.Load(session1, tracePaths[0]);
+    bench.Load(session2, tracePaths[1]);
+
+    const LOADRESULT before = bench.MeasureColdLoad(passCount);
+    {
+        AFilePackage package;
+        const std::wstring_view traces[2] = { tracePaths[0], tracePaths[1] };
+        ATEST_CHECK(package.Open(packagePath, AFPCK_OPENEXIST) && package.Repack(traces) && package.Close());
+    }
+
+    const LOADRESULT after = bench.MeasureColdLoad(passCount);
+
+    std::printf("%zu stored entries, %zu reads in 3 phases, cold cache, median of %zu\n", ENTRY_COUNT, READS_PER_PHASE * 3, passCount);
+    std::printf("before Repack()  %7.3f s  %5zu seeks\n", before.seconds, before.seekCount);
+    std::printf("after Repack()   %7.3f s  %5zu seeks\n", after.seconds, after.seekCount);
+    ATEST_CHECK(bench.VerifyAll());
+
+    ATest_RemovePackage(packagePath);
+    for (const std::wstring& tracePath : tracePaths)
+        std::filesystem::remove(tracePath);
+
+    return ATest_GetFailureCount() == 0 ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+#include "pch.h"
+
+#include <cmath>
+#include <random>
+
+#include "ACodec.h"
+#include "ATestCommon.h"
+
+// Compress and decompress speed of the registered codecs on 64 KB blocks, the unit in which packages
+// compress large entries. Speeds are of the uncompressed bytes, best of 5 passes on one core.
+
+namespace
+{
+    constexpr std::size_t BLOCK_SIZE = 0x10000;
+    constexpr int PASS_COUNT = 5;
+
+    // Vertex streams: positions, normals and texture coordinates of a smooth surface
+    std::vector<std::byte> MakeMeshData(std::size_t length, std::uint32_t seed)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> noise(-0.001f, 0.001f);
+        std::vector<std::byte> data(length);
+        for (std::size_t pos = 0, vertex = 0; pos + 8 * sizeof(float) <= length; pos += 8 * sizeof(float), ++vertex)
+        {
+            const float u = static_cast<float>(vertex % 256) / 256.0f;
+            const float v = static_cast<float>(vertex / 256 % 256) / 256.0f;
+            const float values[8] = { u * 100.0f, std::sin(u * 6.0f) * std::cos(v * 6.0f) * 10.0f + noise(rng), v * 100.0f,
+                0.0f, 1.0f, 0.0f, u, v };
+            std::memcpy(data.data() + pos, values, sizeof(values));
+        }
+
+        return data;
+    }
+
+    void BenchCodec(const ACodec& codec, int level, const char* corpusName, std::span<const std::byte> corpus)
+    {
+        const std::size_t blockCount = corpus.size() / BLOCK_SIZE;
+        const std::size_t bound = codec.GetCompressBound(BLOCK_SIZE);
+        std::vector<std::byte> compressed(blockCount * bound);
+        std::vector<std::size_t> compressedSizes(blockCount);
+        std::vector<std::byte> decoded(corpus.size());
+
+        double compressSeconds = 1e30;
+        double decompressSeconds = 1e30;
+        std::uint64_t compressedBytes = 0;
+        for (int pass = 0; pass < PASS_COUNT; ++pass)
+        {
+            ATestTimer timer;
+            compressedBytes = 0;
+            for (std::size_t i = 0; i < blockCount; ++i)
+            {
+                compressedSizes[i] = codec.Compress(corpus.subspan(i * BLOCK_SIZE, BLOCK_SIZE),
+                    std::span(compressed.data() + i * bound, bound), level);
+                compressedBytes += compressedSizes[i];
+            }
+
+            compressSeconds = std::min(compressSeconds, timer.GetSeconds());
+
+            timer.Restart();
+            bool decodedAll = true;
+            for (std::size_t i = 0; i < blockCount; ++i)
+            {
+                decodedAll &= codec.Decompress(std::span(compressed.data() + i * bound, compressedSizes[i]),
+                    std::span(decoded.data() + i * BLOCK_SIZE, BLOCK_SIZE));
+            }
+
+            decompressSeconds = std::min(decompressSeconds, timer.GetSeconds());
+            ATEST_CHECK(decodedAll && std::find(compressedSizes.begin(), compressedSizes.end(), 0) == compressedSizes.end());
+        }
+
+        ATEST_CHECK(std::memcmp(decoded.data(), corpus.data(), blockCount * BLOCK_SIZE) == 0);
+
+        const std::uint64_t rawBytes = blockCount * BLOCK_SIZE;
+        std::printf("%-4ls level %d  %-5s  ratio %5.2f  compress %7.0f MB/s  decompress %7.0f MB/s\n", codec.GetName(), level,
+            corpusName, static_cast<double>(rawBytes) / static_cast<double>(compressedBytes), ATest_MBPerSecond(rawBytes, compressSeconds),
+            ATest_MBPerSecond(rawBytes, decompressSeconds));
+    }
+}
+
+int ABench_LZCodec(std::span<const std::wstring_view> args)
+{
+    const std::size_t megabytes = ATest_GetOption(args, L"--mb", 32);
+    const std::vector<std::byte> text = ATest_MakeData(megabytes << 20, 1, true);
+    const std::vector<std::byte> mesh = MakeMeshData(megabytes << 20, 2);
+
+    const ACodec* lz = ACodec_Find(ACODEC_LZ);
+    const ACodec* zlib = ACodec_Find(ACODEC_ZLIB);
+    if (!ATEST_CHECK(lz != nullptr && zlib != nullptr))
+        return 1;
+
+    for (const auto& [name, corpus] : { std::pair("text", std::span<const std::byte>(text)), std::pair("mesh", std::span<const std::byte>(mesh)) })
+    {
+        BenchCodec(*lz, 1, name, corpus);
+        BenchCodec(*lz, 9, name, corpus);
+        BenchCodec(*zlib, 1, name, corpus);
+    }
+
+    return ATest_GetFailureCount() == 0 ? 0 : 1;
+}
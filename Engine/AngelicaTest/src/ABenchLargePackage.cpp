@@ -0,0 +1,171 @@
+#include "pch.h"
+
+#include "ACompressionPolicy.h"
+#include "AFilePackage.h"
+#include "ATestCommon.h"
+
+// Packages past 4 GB: writes a package of 128 MB stored files plus small ones in the 64-bit format,
+// reads it back through the stream and the mapping, compacts it, and checks that a legacy-format
+// package refuses to grow past 4 GB instead of wrapping. Needs a 64-bit build for the mapping and
+// about three times the package size in free disk space.
+
+namespace
+{
+    constexpr std::size_t LARGE_FILE_SIZE = 128u << 20;
+    constexpr std::size_t SMALL_FILE_COUNT = 1000;
+
+    std::wstring LargeName(std::size_t index)
+    {
+        return L"HD\\Terrain" + std::to_wstring(index) + L".raw";
+    }
+
+    // The large files are stored as they are, like the already-compressed media of an HD asset set
+    const AAdaptiveCompressionPolicy& GetStorePolicy()
+    {
+        static const AAdaptiveCompressionPolicy policy = []() {
+            AAdaptiveCompressionPolicy storeRaw;
+            storeRaw.SetExtensionRule("raw", ACOMPRESSIONRULE{ ACOMPRESSION_STORE });
+            return storeRaw;
+        }();
+
+        return policy;
+    }
+
+    // One random buffer serves every large file; the first 8 bytes hold the file index
+    void StampFile(std::vector<std::byte>& data, std::uint64_t index)
+    {
+        std::memcpy(data.data(), &index, sizeof(index));
+    }
+
+    double ReadLargeFiles(const std::wstring& packagePath, std::uint32_t flags, std::size_t fileCount, std::vector<std::byte>& expected)
+    {
+        AFilePackage package;
+        if (!ATEST_CHECK(package.Open(packagePath, AFPCK_OPENEXIST, flags)))
+            return 0.0;
+
+        std::vector<std::byte> buffer(LARGE_FILE_SIZE);
+        double seconds = 0.0;
+        for (std::size_t i = 0; i < fileCount; ++i)
+        {
+            const AFPCK_ENTRYINFO* entry = package.FindFile(LargeName(i));
+            if (entry == nullptr)
+                continue;
+
+            std::size_t bytesRead = 0;
+            ATestTimer timer;
+            const bool read = package.ReadFile(*entry, buffer, 0, bytesRead);
+            seconds += timer.GetSeconds();
+
+            StampFile(expected, i);
+            ATEST_CHECK(read && bytesRead == LARGE_FILE_SIZE && buffer == expected);
+        }
+
+        return seconds;
+    }
+
+    // Appends large files to a legacy-format package until it refuses one
+    void TestLegacyLimit(const std::wstring& packagePath, std::vector<std::byte>& data)
+    {
+        ATest_RemovePackage(packagePath);
+
+        std::size_t accepted = 0;
+        {
+            AFilePackage package;
+            if (!ATEST_CHECK(package.Open(packagePath, AFPCK_CREATENEW)))
+                return;
+
+            package.SetCompressionPolicy(&GetStorePolicy());
+            for (std::size_t i = 0; i < 40; ++i)
+            {
+                StampFile(data, i);
+                if (!package.AppendFile(LargeName(i), data))
+                    break;
+
+                ++accepted;
+            }
+
+            ATEST_CHECK(package.Close());
+        }
+
+        AFilePackage package;
+        ATEST_CHECK(package.Open(packagePath, AFPCK_OPENEXIST) && package.GetFileNumber() == accepted);
+        ATEST_CHECK(std::filesystem::file_size(packagePath) < 0x100000000ull);
+        std::printf("legacy format: accepted %zu x 128 MB, refused the next, reopened with %zu entries\n", accepted, package.GetFileNumber());
+
+        package.Close();
+        ATest_RemovePackage(packagePath);
+    }
+}
+
+int ABench_LargePackage(std::span<const std::wstring_view> args)
+{
+    const std::size_t fileCount = ATest_GetOption(args, L"--files", 40);
+    const std::wstring packagePath = ATest_GetWorkPath(L"bench_large.pck");
+    ATest_RemovePackage(packagePath);
+
+    std::vector<std::byte> data = ATest_MakeData(LARGE_FILE_SIZE, 21, false);
+    std::uint64_t writtenBytes = 0;
+    double writeSeconds = 0.0;
+    {
+        AFilePackage package;
+        if (!ATEST_CHECK(package.Open(packagePath, AFPCK_CREATENEW, AFPCK_CREATE_LARGE)))
+            return 1;
+
+        package.SetCompressionPolicy(&GetStorePolicy());
+        ATestTimer timer;
+        for (std::size_t i = 0; i < fileCount; ++i)
+        {
+            StampFile(data, i);
+            ATEST_CHECK(package.AppendFile(LargeName(i), data));
+            writtenBytes += data.size();
+
+            // Small files between the large ones, as an asset set mixes them
+            for (std::size_t j = i * SMALL_FILE_COUNT / fileCount; j < (i + 1) * SMALL_FILE_COUNT / fileCount; ++j)
+            {
+                const std::vector<std::byte> small = ATest_MakeData(4096, static_cast<std::uint32_t>(j), true);
+                ATEST_CHECK(package.AppendFile(L"HD\\Small\\File" + std::to_wstring(j) + L".txt", small));
+                writtenBytes += small.size();
+            }
+
+            if (i % 8 == 7)
+                ATEST_CHECK(package.Commit());
+        }
+
+        ATEST_CHECK(package.Close());
+        writeSeconds = timer.GetSeconds();
+    }
+
+    const std::uint64_t packageBytes = std::filesystem::file_size(packagePath);
+    std::printf("%zu x 128 MB stored + %zu small files, package %.2f GB\n", fileCount, SMALL_FILE_COUNT, packageBytes / 1e9);
+    std::printf("write (AppendFile + commits)  %6.0f MB/s\n", ATest_MBPerSecond(writtenBytes, writeSeconds));
+
+    const std::uint64_t largeBytes = static_cast<std::uint64_t>(fileCount) * LARGE_FILE_SIZE;
+    std::printf("read, stream                  %6.0f MB/s\n", ATest_MBPerSecond(largeBytes, ReadLargeFiles(packagePath, 0, fileCount, data)));
+    std::printf("read, mapped                  %6.0f MB/s\n",
+        ATest_MBPerSecond(largeBytes, ReadLargeFiles(packagePath, AFPCK_OPEN_MAPPED, fileCount, data)));
+
+    // Every tenth large file goes, then the package is rewritten without the holes
+    {
+        AFilePackage package;
+        if (ATEST_CHECK(package.Open(packagePath, AFPCK_OPENEXIST)))
+        {
+            for (std::size_t i = 0; i < fileCount; i += 10)
+                ATEST_CHECK(package.RemoveFile(LargeName(i)));
+
+            ATEST_CHECK(package.Commit());
+
+            AFPCK_COMPACTSTATS stats{};
+            ATestTimer timer;
+            ATEST_CHECK(package.Compact(&stats));
+            std::printf("Compact %.2f -> %.2f GB       %6.1f s\n", stats.oldSize / 1e9, stats.newSize / 1e9, timer.GetSeconds());
+            ATEST_CHECK(package.Close());
+        }
+    }
+
+    ReadLargeFiles(packagePath, AFPCK_OPEN_CONCURRENT, fileCount, data);
+    ATest_RemovePackage(packagePath);
+
+    TestLegacyLimit(ATest_GetWorkPath(L"bench_large_legacy.pck"), data);
+
+    return ATest_GetFailureCount() == 0 ? 0 : 1;
+}
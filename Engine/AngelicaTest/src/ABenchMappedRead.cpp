@@ -0,0 +1,140 @@
+#include "pch.h"
+
+#include "AFilePackage.h"
+#include "ATestCommon.h"
+
+// Reads every entry of a package of small files through the fstream path and through AFPCK_OPEN_MAPPED.
+// Half of the files are compressible text stored with zlib, half are random data stored as is.
+// Timings are the best of 5 passes with the package in the page cache.
+
+namespace
+{
+    constexpr int PASS_COUNT = 5;
+
+    struct READRESULT
+    {
+        double compressedSeconds = 1e30;
+        double storedSeconds = 1e30;
+        double viewSeconds = 1e30;
+        std::uint64_t compressedBytes = 0;
+        std::uint64_t storedBytes = 0;
+    };
+
+    std::wstring FileName(std::size_t index)
+    {
+        return L"zone\\" + std::to_wstring(index % 16) + L"\\file" + std::to_wstring(index) + L".dat";
+    }
+
+    bool CreatePackage(const std::wstring& packagePath, std::size_t fileCount, std::vector<std::vector<std::byte>>& outFiles)
+    {
+        ATest_RemovePackage(packagePath);
+
+        AFilePackage package;
+        if (!package.Open(packagePath, AFPCK_CREATENEW))
+            return false;
+
+        outFiles.resize(fileCount);
+        for (std::size_t i = 0; i < fileCount; ++i)
+        {
+            const std::uint32_t seed = static_cast<std::uint32_t>(i);
+            outFiles[i] = ATest_MakeData(1024 + (i * 7919) % (30 * 1024), seed, i % 2 == 0);
+            if (!package.AppendFile(FileName(i), outFiles[i]))
+                return false;
+        }
+
+        return package.Close();
+    }
+
+    READRESULT ReadAll(const std::wstring& packagePath, std::uint32_t flags, const std::vector<std::vector<std::byte>>& files)
+    {
+        READRESULT result;
+        AFilePackage package;
+        if (!ATEST_CHECK(package.Open(packagePath, AFPCK_OPENEXIST, flags)))
+            return result;
+
+        // Lookups stay out of the timed loops
+        std::vector<const AFPCK_ENTRYINFO*> entries(files.size());
+        for (std::size_t i = 0; i < files.size(); ++i)
+            entries[i] = package.FindFile(FileName(i));
+
+        if (!ATEST_CHECK(std::find(entries.begin(), entries.end(), nullptr) == entries.end()))
+            return result;
+
+        std::vector<std::byte> buffer(32 * 1024);
+        for (int pass = 0; pass < PASS_COUNT; ++pass)
+        {
+            for (bool compressed : { true, false })
+            {
+                std::uint64_t bytes = 0;
+                ATestTimer timer;
+                for (std::size_t i = 0; i < entries.size(); ++i)
+                {
+                    const AFPCK_ENTRYINFO& entry = *entries[i];
+                    if ((entry.dwCompressedLength < entry.dwLength) != compressed)
+                        continue;
+
+                    std::size_t bytesRead = 0;
+                    ATEST_CHECK(package.ReadFile(entry, std::span(buffer.data(), entry.dwLength), 0, bytesRead));
+
+                    bytes += bytesRead;
+                }
+
+                double& best = compressed ? result.compressedSeconds : result.storedSeconds;
+                best = std::min(best, timer.GetSeconds());
+                (compressed ? result.compressedBytes : result.storedBytes) = bytes;
+            }
+
+            if (flags & AFPCK_OPEN_MAPPED)
+            {
+                std::uint64_t sum = 0;
+                ATestTimer timer;
+                for (const AFPCK_ENTRYINFO* entry : entries)
+                {
+                    std::span<const std::byte> view;
+                    if (entry->dwCompressedLength == entry->dwLength && package.GetFileView(*entry, view))
+                        sum += static_cast<std::uint64_t>(view.front()) + view.size();
+                }
+
+                result.viewSeconds = std::min(result.viewSeconds, timer.GetSeconds());
+                ATEST_CHECK(sum > 0);
+            }
+        }
+
+        // One checked pass after the timed ones
+        for (std::size_t i = 0; i < entries.size(); ++i)
+        {
+            std::size_t bytesRead = 0;
+            ATEST_CHECK(package.ReadFile(*entries[i], std::span(buffer.data(), entries[i]->dwLength), 0, bytesRead) &&
+                bytesRead == files[i].size() && std::memcmp(buffer.data(), files[i].data(), bytesRead) == 0);
+        }
+
+        return result;
+    }
+}
+
+int ABench_MappedRead(std::span<const std::wstring_view> args)
+{
+    const std::size_t fileCount = ATest_GetOption(args, L"--files", 5000);
+    const std::wstring packagePath = ATest_GetWorkPath(L"bench_mapped.pck");
+
+    std::vector<std::vector<std::byte>> files;
+    if (!ATEST_CHECK(CreatePackage(packagePath, fileCount, files)))
+        return 1;
+
+    const auto packageBytes = std::filesystem::file_size(packagePath);
+    std::printf("%zu entries, %.1f MB package\n", fileCount, packageBytes / (1024.0 * 1024.0));
+
+    const READRESULT stream = ReadAll(packagePath, 0, files);
+    const READRESULT mapped = ReadAll(packagePath, AFPCK_OPEN_MAPPED, files);
+    std::printf("                      stream (fstream)         mapped (AFPCK_OPEN_MAPPED)\n");
+    std::printf("compressed, ReadFile  %.3f s %8.0f MB/s     %.3f s %8.0f MB/s\n", stream.compressedSeconds,
+        ATest_MBPerSecond(stream.compressedBytes, stream.compressedSeconds), mapped.compressedSeconds,
+        ATest_MBPerSecond(mapped.compressedBytes, mapped.compressedSeconds));
+    std::printf("stored, ReadFile      %.3f s %8.0f MB/s     %.3f s %8.0f MB/s\n", stream.storedSeconds,
+        ATest_MBPerSecond(stream.storedBytes, stream.storedSeconds), mapped.storedSeconds,
+        ATest_MBPerSecond(mapped.storedBytes, mapped.storedSeconds));
+    std::printf("stored, GetFileView   n/a                      %.3f ms (no copy)\n", mapped.viewSeconds * 1000.0);
+
+    ATest_RemovePackage(packagePath);
+    return ATest_GetFailureCount() == 0 ? 0 : 1;
+}
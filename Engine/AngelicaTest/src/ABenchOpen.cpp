@@ -0,0 +1,100 @@
+#include "pch.h"
+
+#include "AFilePackage.h"
+#include "ATestCommon.h"
+
+// Open() time of packages with 10k, 100k and 1M one-byte entries in every open mode, parsing the
+// directory and then again through the .idx sidecar. Best of 3, with the package in the page cache.
+
+namespace
+{
+    constexpr int PASS_COUNT = 3;
+    constexpr std::uint32_t OPEN_FLAGS[3] = { 0, AFPCK_OPEN_MAPPED, AFPCK_OPEN_CONCURRENT };
+
+    std::wstring EntryName(std::size_t index)
+    {
+        return L"models\\characters\\npc_" + std::to_wstring(index % 977) + L"\\textures\\skin_" + std::to_wstring(index) + L".dds";
+    }
+
+    bool CreatePackage(const std::wstring& packagePath, std::size_t entryCount)
+    {
+        ATest_RemovePackage(packagePath);
+
+        AFilePackage package;
+        if (!package.Open(packagePath, AFPCK_CREATENEW))
+            return false;
+
+        // Appended in batches, the package directory is what is measured here
+        constexpr std::size_t batchSize = 10000;
+        static constexpr std::byte content[1] = { std::byte{ 'x' } };
+        std::vector<std::wstring> names;
+        std::vector<AFPCK_APPENDITEM> items;
+        for (std::size_t first = 0; first < entryCount; first += batchSize)
+        {
+            const std::size_t count = std::min(batchSize, entryCount - first);
+            names.clear();
+            items.clear();
+            for (std::size_t i = 0; i < count; ++i)
+                names.push_back(EntryName(first + i));
+
+            for (const std::wstring& name : names)
+                items.push_back(AFPCK_APPENDITEM{ name, content });
+
+            if (!package.AppendFiles(items))
+                return false;
+        }
+
+        return package.Close();
+    }
+
+    double MeasureOpen(const std::wstring& packagePath, std::uint32_t flags, std::size_t entryCount)
+    {
+        double best = 1e30;
+        for (int pass = 0; pass < PASS_COUNT; ++pass)
+        {
+            AFilePackage package;
+            ATestTimer timer;
+            const bool opened = package.Open(packagePath, AFPCK_OPENEXIST, flags);
+            const double seconds = timer.GetSeconds();
+            if (!ATEST_CHECK(opened && package.GetFileNumber() == entryCount && package.FindFile(EntryName(entryCount / 2)) != nullptr))
+                break;
+
+            best = std::min(best, seconds);
+        }
+
+        return best * 1000.0;
+    }
+}
+
+int ABench_Open(std::span<const std::wstring_view> args)
+{
+    const std::size_t maxEntries = ATest_GetOption(args, L"--max", 1000000);
+    const std::wstring packagePath = ATest_GetWorkPath(L"bench_open.pck");
+
+    std::printf("Open time in ms   %32s  %32s\n", "directory parsed", "from the .idx sidecar");
+    std::printf("%-18s%10s%10s%12s  %10s%10s%12s\n", "", "stream", "mapped", "concurrent", "stream", "mapped", "concurrent");
+    for (std::size_t entryCount = 10000; entryCount <= maxEntries; entryCount *= 10)
+    {
+        if (!ATEST_CHECK(CreatePackage(packagePath, entryCount)))
+            break;
+
+        double parsed[3] = {};
+        double indexed[3] = {};
+        for (int mode = 0; mode < 3; ++mode)
+            parsed[mode] = MeasureOpen(packagePath, OPEN_FLAGS[mode], entryCount);
+
+        {
+            AFilePackage package;
+            ATEST_CHECK(package.Open(packagePath, AFPCK_OPENEXIST, AFPCK_OPEN_MAPPED) && package.SaveIndex());
+        }
+
+        for (int mode = 0; mode < 3; ++mode)
+            indexed[mode] = MeasureOpen(packagePath, OPEN_FLAGS[mode], entryCount);
+
+        std::printf("%8zu entries  %10.1f%10.1f%12.1f  %10.1f%10.1f%12.1f\n", entryCount, parsed[0], parsed[1], parsed[2],
+            indexed[0], indexed[1], indexed[2]);
+    }
+
+    ATest_RemovePackage(packagePath);
+    return ATest_GetFailureCount() == 0 ? 0 : 1;
+}
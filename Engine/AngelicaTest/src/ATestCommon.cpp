@@ -0,0 +1,92 @@
+#include "pch.h"
+
+#include <cwchar>
+#include <random>
+
+#include "ATestCommon.h"
+
+namespace
+{
+    int s_failureCount = 0;
+    std::filesystem::path s_workDir;
+}
+
+bool ATest_Check(bool condition, const char* expression, const char* file, int line)
+{
+    if (!condition)
+    {
+        ++s_failureCount;
+        std::printf("FAILED: %s (%s:%d)\n", expression, std::filesystem::path(file).filename().string().c_str(), line);
+    }
+
+    return condition;
+}
+
+int ATest_GetFailureCount()
+{
+    return s_failureCount;
+}
+
+void ATest_SetWorkDir(std::wstring_view workDir)
+{
+    s_workDir = workDir;
+}
+
+std::wstring ATest_GetWorkPath(std::wstring_view fileName)
+{
+    if (s_workDir.empty())
+        s_workDir = std::filesystem::temp_directory_path() / L"AngelicaTest";
+
+    std::error_code error;
+    std::filesystem::create_directories(s_workDir, error);
+
+    return (s_workDir / fileName).wstring();
+}
+
+void ATest_RemovePackage(const std::wstring& packagePath)
+{
+    std::error_code error;
+    for (const wchar_t* suffix : { L"", L".idx", L".idx.tmp", L".tmp" })
+        std::filesystem::remove(packagePath + suffix, error);
+}
+
+std::vector<std::byte> ATest_MakeData(std::size_t length, std::uint32_t seed, bool compressible)
+{
+    std::mt19937 rng(seed);
+    std::vector<std::byte> data(length);
+    if (!compressible)
+    {
+        for (std::byte& value : data)
+            value = static_cast<std::byte>(rng());
+
+        return data;
+    }
+
+    // Words from a small vocabulary, like the text and script assets of a game
+    static constexpr std::string_view words[] = { "model", "texture", "float", "position", "rotation", "scale",
+        "material", "diffuse", "normal", "specular", "animation", "frame", "bone", "weight", "0.5", "1.0", "{", "}",
+        "true", "false", "name", "=", ";", "\r\n", "    ", "zone", "npc", "quest", "item", "effect" };
+    std::size_t pos = 0;
+    while (pos < length)
+    {
+        const std::string_view word = words[rng() % std::size(words)];
+        for (std::size_t i = 0; i < word.size() && pos < length; ++i)
+            data[pos++] = static_cast<std::byte>(word[i]);
+
+        if (pos < length)
+            data[pos++] = static_cast<std::byte>(rng() % 4 == 0 ? '0' + rng() % 10 : ' ');
+    }
+
+    return data;
+}
+
+std::size_t ATest_GetOption(std::span<const std::wstring_view> args, std::wstring_view name, std::size_t defaultValue)
+{
+    for (std::size_t i = 0; i + 1 < args.size(); ++i)
+    {
+        if (args[i] == name)
+            return static_cast<std::size_t>(std::wcstoull(std::wstring(args[i + 1]).c_str(), nullptr, 10));
+    }
+
+    return defaultValue;
+}
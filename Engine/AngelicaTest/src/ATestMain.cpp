@@ -0,0 +1,67 @@
+#include "pch.h"
+
+#include "AFI.h"
+#include "ATestCommon.h"
+
+namespace
+{
+    struct TESTCOMMAND
+    {
+        std::wstring_view name;
+        ATEST_COMMAND run;
+        const char* description;
+    };
+
+    constexpr TESTCOMMAND s_commands[] = {
+        { L"test-package", ATest_Package, "Create, commit, reopen, compact and the sidecar in every open mode; legacy packages" },
+        { L"bench-mapped", ABench_MappedRead, "ReadFile() through the stream and the mapping, GetFileView() [--files N]" },
+        { L"bench-lz", ABench_LZCodec, "LZ and zlib compress and decompress speed on 64 KB blocks [--mb N]" },
+        { L"bench-open", ABench_Open, "Open() time at 10k, 100k and 1M entries, parsed and from the .idx sidecar [--max N]" },
+        { L"bench-large", ABench_LargePackage, "Write, read and compact a 64-bit package of 128 MB files; the legacy 4 GB limit [--files N]" },
+        { L"bench-coldload", ABench_ColdLoad, "Cold-cache load time of traced load phases before and after Repack() [--passes N]" },
+    };
+
+    void PrintUsage()
+    {
+        std::printf("Usage: AngelicaTest <command> [--dir <work directory>] [options]\n");
+        for (const TESTCOMMAND& command : s_commands)
+            std::printf("  %-14ls %s\n", std::wstring(command.name).c_str(), command.description);
+    }
+}
+
+// Console runner for the package tests and benchmarks; no arguments runs nothing and prints the commands
+int wmain(int argc, wchar_t* argv[])
+{
+    if (argc < 2)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    std::vector<std::wstring_view> args(argv + 2, argv + argc);
+    for (std::size_t i = 0; i + 1 < args.size(); ++i)
+    {
+        if (args[i] == L"--dir")
+            ATest_SetWorkDir(args[i + 1]);
+    }
+
+    const std::wstring_view name = argv[1];
+    const auto it = std::find_if(std::begin(s_commands), std::end(s_commands), [name](const TESTCOMMAND& command) {
+        return command.name == name;
+    });
+
+    if (it == std::end(s_commands))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    // Errors of the file module go to Logs\AF.log, see AFileMod_Initialize()
+    AFileMod_Initialize();
+
+    const int result = it->run(args);
+    AFileMod_Finalize();
+
+    std::printf("%ls: %s\n", std::wstring(name).c_str(), result == 0 ? "passed" : "FAILED");
+    return result;
+}
@@ -0,0 +1,318 @@
+#include "pch.h"
+
+#include <map>
+#include <thread>
+
+#include "ACodec.h"
+#include "AFilePackage.h"
+#include "ATestCommon.h"
+#include "zlib.h"
+
+// Round trips of AFilePackage: create, commit, reopen in every open mode, remove, replace, compact,
+// the .idx sidecar, reads from many threads, and packages written in the legacy 0x00010003 format.
+
+namespace
+{
+    using FILEMAP = std::map<std::wstring, std::vector<std::byte>>;
+
+    constexpr std::uint32_t OPEN_MODES[] = { 0, AFPCK_OPEN_MAPPED, AFPCK_OPEN_CONCURRENT };
+
+    bool ReadWhole(AFilePackage& package, const AFPCK_ENTRYINFO& entry, std::vector<std::byte>& outData)
+    {
+        outData.assign(entry.dwLength, std::byte{ 0 });
+        std::size_t bytesRead = 0;
+        return package.ReadFile(entry, outData, 0, bytesRead) && bytesRead == entry.dwLength;
+    }
+
+    // Every file can be found and reads back as written, and nothing else is in the package
+    void VerifyPackage(const std::wstring& packagePath, std::uint32_t flags, const FILEMAP& files)
+    {
+        AFilePackage package;
+        if (!ATEST_CHECK(package.Open(packagePath, AFPCK_OPENEXIST, flags)))
+            return;
+
+        ATEST_CHECK(package.GetFileNumber() == files.size());
+
+        std::vector<std::byte> data;
+        for (const auto& [name, content] : files)
+        {
+            const AFPCK_ENTRYINFO* entry = package.FindFile(name);
+            if (!ATEST_CHECK(entry != nullptr))
+            {
+                std::printf("  missing %ls (open flags %u)\n", name.c_str(), flags);
+                continue;
+            }
+
+            if (!ATEST_CHECK(ReadWhole(package, *entry, data) && data == content))
+                std::printf("  wrong content of %ls (open flags %u)\n", name.c_str(), flags);
+        }
+    }
+
+    void VerifyAllModes(const std::wstring& packagePath, const FILEMAP& files)
+    {
+        for (std::uint32_t flags : OPEN_MODES)
+            VerifyPackage(packagePath, flags, files);
+    }
+
+    bool AppendFile(AFilePackage& package, FILEMAP& files, const std::wstring& name, std::vector<std::byte> content,
+        std::uint32_t codecId = AFPCK_CODEC_AUTO)
+    {
+        if (!package.AppendFile(name, content, codecId))
+            return false;
+
+        files[name] = std::move(content);
+        return true;
+    }
+
+    // Create, commit, reopen, remove, replace, compact and the sidecar
+    void TestRoundTrip(const std::wstring& packagePath, FILEMAP& files)
+    {
+        std::printf("round trip\n");
+        ATest_RemovePackage(packagePath);
+
+        {
+            AFilePackage package;
+            if (!ATEST_CHECK(package.Open(packagePath, AFPCK_CREATENEW)))
+                return;
+
+            ATEST_CHECK(package.SetExtensionCodec(L"lz", ACODEC_LZ));
+            for (std::uint32_t i = 0; i < 200; ++i)
+            {
+                const std::wstring name = L"Models\\Zone" + std::to_wstring(i % 8) + L"\\File" + std::to_wstring(i);
+                ATEST_CHECK(AppendFile(package, files, name + L".txt", ATest_MakeData(i * 97 % 5000, i, true)));
+                ATEST_CHECK(AppendFile(package, files, name + L".lz", ATest_MakeData(i * 131 % 7000, i + 1000, true)));
+                ATEST_CHECK(AppendFile(package, files, name + L".bin", ATest_MakeData(i * 61 % 3000, i + 2000, false)));
+            }
+
+            // Block-compressed with both codecs, and a file of zero bytes
+            ATEST_CHECK(AppendFile(package, files, L"Big\\Terrain.txt", ATest_MakeData(700 * 1024, 1, true)));
+            ATEST_CHECK(AppendFile(package, files, L"Big\\Terrain.lz", ATest_MakeData(500 * 1024, 2, true)));
+            ATEST_CHECK(AppendFile(package, files, L"Empty.txt", {}));
+            ATEST_CHECK(package.Commit());
+
+            // Names fold case and separators, so these exist already
+            ATEST_CHECK(!package.AppendFile(L"models/zone0/file0.TXT", ATest_MakeData(10, 0, true)));
+            ATEST_CHECK(!package.AppendFile(std::wstring(300, L'x'), ATest_MakeData(10, 0, true)));
+
+            ATEST_CHECK(AppendFile(package, files, L"Late\\AfterCommit.txt", ATest_MakeData(4000, 3, true)));
+            ATEST_CHECK(package.Close());
+        }
+
+        VerifyAllModes(packagePath, files);
+
+        {
+            AFilePackage package;
+            if (!ATEST_CHECK(package.Open(packagePath, AFPCK_OPENEXIST)))
+                return;
+
+            for (std::uint32_t i = 0; i < 200; i += 3)
+            {
+                const std::wstring name = L"Models\\Zone" + std::to_wstring(i % 8) + L"\\File" + std::to_wstring(i) + L".bin";
+                ATEST_CHECK(package.RemoveFile(name));
+                files.erase(name);
+            }
+
+            std::vector<std::byte> content = ATest_MakeData(20000, 4, true);
+#pragma push_macro("ReplaceFile")
+#undef ReplaceFile
+            ATEST_CHECK(package.ReplaceFile(L"Big\\Terrain.txt", content));
+#pragma pop_macro("ReplaceFile")
+            files[L"Big\\Terrain.txt"] = std::move(content);
+            ATEST_CHECK(package.Commit());
+
+            // Uncommitted changes are visible to the package that made them
+            ATEST_CHECK(package.FindFile(L"Models\\Zone0\\File0.bin") == nullptr);
+            ATEST_CHECK(package.Close());
+        }
+
+        VerifyAllModes(packagePath, files);
+
+        {
+            AFilePackage package;
+            AFPCK_COMPACTSTATS stats{};
+            if (ATEST_CHECK(package.Open(packagePath, AFPCK_OPENEXIST)))
+            {
+                ATEST_CHECK(package.Compact(&stats));
+                ATEST_CHECK(stats.entryCount == files.size() && stats.newSize < stats.oldSize);
+                ATEST_CHECK(stats.newSize == std::filesystem::file_size(packagePath));
+                ATEST_CHECK(package.Close());
+            }
+
+            std::printf("  compact %llu -> %llu bytes\n", static_cast<unsigned long long>(stats.oldSize),
+                static_cast<unsigned long long>(stats.newSize));
+        }
+
+        VerifyAllModes(packagePath, files);
+
+        // A read-only open can write the sidecar, and later opens take the directory from it
+        {
+            AFilePackage package;
+            ATEST_CHECK(package.Open(packagePath, AFPCK_OPENEXIST, AFPCK_OPEN_MAPPED) && package.SaveIndex());
+        }
+
+        ATEST_CHECK(std::filesystem::exists(packagePath + L".idx"));
+        VerifyAllModes(packagePath, files);
+
+        // A commit makes the sidecar stale; it must be ignored, not trusted
+        {
+            AFilePackage package;
+            if (ATEST_CHECK(package.Open(packagePath, AFPCK_OPENEXIST)))
+            {
+                ATEST_CHECK(AppendFile(package, files, L"Late\\AfterIndex.txt", ATest_MakeData(3000, 5, true)));
+                ATEST_CHECK(package.RemoveFile(L"Late\\AfterCommit.txt"));
+                files.erase(L"Late\\AfterCommit.txt");
+                ATEST_CHECK(package.Close());
+            }
+        }
+
+        VerifyAllModes(packagePath, files);
+    }
+
+    // Mapped and concurrent packages serve ReadFile() from many threads at once
+    void TestConcurrentReads(const std::wstring& packagePath, const FILEMAP& files)
+    {
+        std::printf("concurrent reads\n");
+        for (std::uint32_t flags : { AFPCK_OPEN_MAPPED, AFPCK_OPEN_CONCURRENT })
+        {
+            AFilePackage package;
+            if (!ATEST_CHECK(package.Open(packagePath, AFPCK_OPENEXIST, flags)))
+                continue;
+
+            std::vector<std::pair<const AFPCK_ENTRYINFO*, const std::vector<std::byte>*>> entries;
+            for (const auto& [name, content] : files)
+                entries.emplace_back(package.FindFile(name), &content);
+
+            constexpr unsigned int threadCount = 8;
+            std::vector<int> failures(threadCount, 0);
+            std::vector<std::thread> threads;
+            for (unsigned int t = 0; t < threadCount; ++t)
+            {
+                threads.emplace_back([&, t]() {
+                    std::vector<std::byte> data;
+                    for (int pass = 0; pass < 4; ++pass)
+                    {
+                        // Each thread walks the entries from a different start
+                        for (std::size_t i = 0; i < entries.size(); ++i)
+                        {
+                            const auto& [entry, content] = entries[(i + t * entries.size() / threadCount) % entries.size()];
+                            if (entry == nullptr || !ReadWhole(package, *entry, data) || data != *content)
+                                ++failures[t];
+                        }
+                    }
+                });
+            }
+
+            for (std::thread& thread : threads)
+                thread.join();
+
+            for (unsigned int t = 0; t < threadCount; ++t)
+                ATEST_CHECK(failures[t] == 0);
+        }
+    }
+
+    // Writes a package the way the 2002 release did: payloads from offset 0, then the directory
+    // (name length with terminator, name, offset, length, compressed length), then AFPCK_FILEHEADER,
+    // the entry count and the version.
+    bool WriteLegacyPackage(const std::wstring& packagePath, const FILEMAP& files)
+    {
+        std::ofstream file(std::filesystem::path(packagePath), std::ios::binary | std::ios::trunc);
+        std::vector<char> directory;
+        auto append = [&directory](const void* data, std::size_t length) {
+            directory.insert(directory.end(), static_cast<const char*>(data), static_cast<const char*>(data) + length);
+        };
+
+        std::uint32_t offset = 0;
+        for (const auto& [name, content] : files)
+        {
+            // Compressed only where zlib helps, as AFilePackage always did
+            std::vector<std::byte> stored(compressBound(static_cast<uLong>(content.size())));
+            uLongf storedLength = static_cast<uLongf>(stored.size());
+            if (compress2(reinterpret_cast<Bytef*>(stored.data()), &storedLength, reinterpret_cast<const Bytef*>(content.data()),
+                    static_cast<uLong>(content.size()), 1) != Z_OK || storedLength >= content.size())
+                stored = content;
+            else
+                stored.resize(storedLength);
+
+            file.write(reinterpret_cast<const char*>(stored.data()), static_cast<std::streamsize>(stored.size()));
+
+            const std::string narrowName(name.begin(), name.end());
+            const int nameLen = static_cast<int>(narrowName.size() + 1);
+            const std::uint32_t fields[] = { offset, static_cast<std::uint32_t>(content.size()), static_cast<std::uint32_t>(stored.size()) };
+            append(&nameLen, sizeof(nameLen));
+            append(narrowName.c_str(), nameLen);
+            append(fields, sizeof(fields));
+            offset += static_cast<std::uint32_t>(stored.size());
+        }
+
+        AFPCK_FILEHEADER header{};
+        header.dwVersion = 0x00010003u;
+        header.dwEntryOffset = offset;
+        std::strcpy(header.szDescription, "Angelica File Package");
+        const int fileCount = static_cast<int>(files.size());
+        append(&header, sizeof(header));
+        append(&fileCount, sizeof(fileCount));
+        append(&header.dwVersion, sizeof(header.dwVersion));
+        file.write(directory.data(), static_cast<std::streamsize>(directory.size()));
+
+        return file.good();
+    }
+
+    // Legacy packages open in every mode, and a writable open upgrades them on the first commit
+    void TestLegacyPackage(const std::wstring& packagePath)
+    {
+        std::printf("legacy 0x00010003\n");
+        ATest_RemovePackage(packagePath);
+
+        FILEMAP files;
+        for (std::uint32_t i = 0; i < 300; ++i)
+            files[L"Textures\\Old" + std::to_wstring(i) + L".dds"] = ATest_MakeData(i * 113 % 9000, i, i % 3 != 0);
+
+        if (!ATEST_CHECK(WriteLegacyPackage(packagePath, files)))
+            return;
+
+        VerifyAllModes(packagePath, files);
+
+        {
+            AFilePackage package;
+            if (ATEST_CHECK(package.Open(packagePath, AFPCK_OPENEXIST)))
+            {
+                ATEST_CHECK(AppendFile(package, files, L"Textures\\New.dds", ATest_MakeData(5000, 7, true)));
+                ATEST_CHECK(package.RemoveFile(L"Textures\\Old1.dds"));
+                files.erase(L"Textures\\Old1.dds");
+                ATEST_CHECK(package.Close());
+            }
+        }
+
+        VerifyAllModes(packagePath, files);
+
+        {
+            AFilePackage package;
+            if (ATEST_CHECK(package.Open(packagePath, AFPCK_OPENEXIST)))
+            {
+                ATEST_CHECK(package.Compact());
+                ATEST_CHECK(package.Close());
+            }
+        }
+
+        VerifyAllModes(packagePath, files);
+    }
+}
+
+int ATest_Package(std::span<const std::wstring_view> args)
+{
+    const std::wstring packagePath = ATest_GetWorkPath(L"test_package.pck");
+    const std::wstring legacyPath = ATest_GetWorkPath(L"test_legacy.pck");
+
+    FILEMAP files;
+    TestRoundTrip(packagePath, files);
+    TestConcurrentReads(packagePath, files);
+    TestLegacyPackage(legacyPath);
+
+    if (ATest_GetFailureCount() == 0)
+    {
+        ATest_RemovePackage(packagePath);
+        ATest_RemovePackage(legacyPath);
+    }
+
+    return ATest_GetFailureCount() == 0 ? 0 : 1;
+}